@@ -0,0 +1,60 @@
+#include "bench.hpp"
+
+#include <time.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = malloc(size ?: 1)) return ptr;
+    abort();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ?: 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+namespace bench {
+
+static const char *filter = nullptr;
+
+size_t Allocations() { return allocations.load(std::memory_order_relaxed); }
+
+uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool Selected(const char *name) { return filter == nullptr || strstr(name, filter); }
+
+void Report(const char *name, size_t iterations, uint64_t ns, size_t allocations) {
+    printf("%-40s %12.1f ns/op %8.2f allocs/op %10zu iterations\n", name,
+           (double) ns / iterations, (double) allocations / iterations, iterations);
+    fflush(stdout);
+}
+
+void SetFilter(const char *name) { filter = name; }
+
+}  // namespace bench
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A minimal harness for zygisk-bench. Each case reports its time per operation and its
+// heap allocations per operation, operator new is counted by bench.cpp.
+namespace bench {
+
+size_t Allocations();
+
+uint64_t NowNs();
+
+// Only cases whose name contains the filter run, all of them without one
+void SetFilter(const char *name);
+bool Selected(const char *name);
+
+void Report(const char *name, size_t iterations, uint64_t ns, size_t allocations);
+
+// Batches of calls double until one takes kMinBatchNs, so the clock is read only per batch
+constexpr uint64_t kMinBatchNs = 200'000'000;
+
+template <typename F>
+void Run(const char *name, F &&fn) {
+    if (!Selected(name)) return;
+    // Warm up caches and lazily initialized state
+    fn();
+    for (size_t iterations = 1;; iterations *= 2) {
+        size_t allocations = Allocations();
+        uint64_t start = NowNs();
+        for (size_t i = 0; i < iterations; i++) fn();
+        uint64_t elapsed = NowNs() - start;
+        if (elapsed >= kMinBatchNs) {
+            Report(name, iterations, elapsed, Allocations() - allocations);
+            return;
+        }
+    }
+}
+
+// Keeps the compiler from optimizing a result away
+template <typename T>
+inline void DoNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}  // namespace bench
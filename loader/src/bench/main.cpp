@@ -0,0 +1,197 @@
+#include <fcntl.h>
+#include <regex.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "elf_util.hpp"
+#include "files.hpp"
+#include "maps.hpp"
+#include "socket_utils.hpp"
+#include "utils.hpp"
+
+// zygisk-bench [filter]
+// Microbenchmarks of the helpers on the hot paths of zygote and its children.
+// Build with -DZYGISK_BENCHMARK=ON, push the binary and run it through adb shell.
+
+static constexpr const char *kLinker = "/linker";
+// One symbol exported through .dynsym and one only in .symtab, as looked up by clean.cpp
+static constexpr const char *kDynamicSymbol = "__loader_dlopen";
+static constexpr const char *kStaticSymbol = "__dl__ZN18ProtectedDataGuardC2Ev";
+static constexpr const char *kSymbolPrefix = "__dl__ZL6solist";
+
+static void bench_elf_img() {
+    SandHook::ElfImg linker(kLinker);
+    if (!linker.isValid()) {
+        printf("skipping ElfImg cases, %s is not loaded\n", kLinker);
+        return;
+    }
+    bench::Run("ElfImg construction", [] {
+        SandHook::ElfImg img(kLinker);
+        bench::DoNotOptimize(img.isValid());
+    });
+    bench::Run("ElfImg::getSymbAddress dynamic", [&] {
+        bench::DoNotOptimize(linker.getSymbAddress(kDynamicSymbol));
+    });
+    bench::Run("ElfImg::getSymbAddress static", [&] {
+        bench::DoNotOptimize(linker.getSymbAddress(kStaticSymbol));
+    });
+    bench::Run("ElfImg::findSymbolNameByPrefix", [&] {
+        bench::DoNotOptimize(linker.findSymbolNameByPrefix(kSymbolPrefix));
+    });
+    bench::Run("ElfImg::resolve", [&] {
+        SandHook::ElfImg::SymbolQuery queries[] = {
+            {kDynamicSymbol}, {kStaticSymbol}, {kSymbolPrefix, true}};
+        linker.resolve(queries);
+        bench::DoNotOptimize(queries[2].address);
+    });
+}
+
+// Large enough to stand for zygote after ART loaded its boot image and all the preloads
+static std::string write_synthetic_maps(size_t entries) {
+    char path[] = "/data/local/tmp/zygisk-bench-maps-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return {};
+    std::string content;
+    char line[256];
+    uintptr_t addr = 0x6f000000;
+    for (size_t i = 0; i < entries; i++) {
+        static const char *const perms[] = {"r--p", "r-xp", "rw-p", "---p"};
+        int len = snprintf(line, sizeof(line),
+                           "%08zx-%08zx %s %08zx fd:%02zx %zu"
+                           "                          /system/lib64/libbench%zu.so\n",
+                           addr, addr + 0x4000, perms[i % 4], (i % 4) * 0x4000, i % 7,
+                           1000 + i / 4, i / 4);
+        content.append(line, len);
+        addr += 0x4000;
+    }
+    bool written = socket_utils::xwrite(fd, content.data(), content.size()) == content.size();
+    close(fd);
+    if (!written) {
+        unlink(path);
+        return {};
+    }
+    return path;
+}
+
+static void bench_maps() {
+    std::string path = write_synthetic_maps(8192);
+    if (path.empty()) {
+        printf("skipping maps cases, cannot write a synthetic maps file\n");
+        return;
+    }
+    bench::Run("MapsReader 8192 entries", [&] {
+        MapsReader reader(path.data());
+        size_t count = 0;
+        for (MapEntry entry; reader.Next(entry);) count++;
+        bench::DoNotOptimize(count);
+    });
+    bench::Run("ScanMaps 8192 entries", [&] {
+        std::vector<MapInfo> infos;
+        MapsReader reader(path.data());
+        for (MapEntry entry; reader.Next(entry);) {
+            infos.emplace_back(MapInfo{entry.start, entry.end, entry.perms, entry.is_private,
+                                            entry.offset, entry.dev, entry.inode,
+                                            std::string(entry.path)});
+        }
+        bench::DoNotOptimize(infos.size());
+    });
+    bench::Run("MapInfo::Scan self", [] { bench::DoNotOptimize(MapInfo::Scan().size()); });
+    unlink(path.data());
+}
+
+// A request and its reply as exchanged with zygiskd, both ends in this thread
+static void bench_socket_utils() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        printf("skipping socket cases, socketpair failed\n");
+        return;
+    }
+    std::string name = "/data/adb/modules/bench/zygisk/arm64-v8a.so";
+    bench::Run("socket_utils u32 round trip", [&] {
+        socket_utils::write_u32(fds[0], 1000);
+        uint32_t request = socket_utils::read_u32(fds[1]);
+        socket_utils::write_u32(fds[1], request);
+        bench::DoNotOptimize(socket_utils::read_u32(fds[0]));
+    });
+    bench::Run("socket_utils FrameWriter round trip", [&] {
+        socket_utils::FrameWriter(fds[0]).u8(1).u32(1000).string(name).flush();
+        socket_utils::FrameReader reader(fds[1]);
+        reader.fill(sizeof(uint8_t) + sizeof(uint32_t));
+        bench::DoNotOptimize(reader.u8() + reader.u32());
+        std::string request = socket_utils::read_string(fds[1]);
+        socket_utils::write_string(fds[1], request);
+        bench::DoNotOptimize(socket_utils::read_string(fds[0]).size());
+    });
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Registered regexes matched against the paths of all mapped libraries, the way
+// plt_hook_process_regex does, compared with the same patterns as plain strings
+static void bench_path_regex() {
+    std::vector<std::string> paths;
+    MapsReader reader;
+    for (MapEntry entry; reader.Next(entry);) {
+        if (entry.offset == 0 && !entry.path.empty()) paths.emplace_back(entry.path);
+    }
+    static const char *const patterns[] = {".*/libc\\.so$", ".*/libandroid_runtime\\.so$",
+                                           ".*libart\\.so$", ".*\\.so$"};
+    std::vector<regex_t> regexes;
+    for (auto *pattern : patterns) {
+        regex_t re;
+        if (regcomp(&re, pattern, REG_NOSUB) == 0) regexes.push_back(re);
+    }
+    bench::Run("path regexec per library", [&] {
+        size_t matched = 0;
+        for (auto &path : paths) {
+            for (auto &re : regexes) matched += regexec(&re, path.data(), 0, nullptr, 0) == 0;
+        }
+        bench::DoNotOptimize(matched);
+    });
+    static const char *const suffixes[] = {"/libc.so", "/libandroid_runtime.so", "libart.so",
+                                           ".so"};
+    bench::Run("path literal suffix per library", [&] {
+        size_t matched = 0;
+        for (auto &path : paths) {
+            for (auto *suffix : suffixes) matched += path.ends_with(suffix);
+        }
+        bench::DoNotOptimize(matched);
+    });
+    for (auto &re : regexes) regfree(&re);
+}
+
+// Zygote has about a hundred fds open when it forks. sanitize_fds snapshots them before the
+// fork and closes everything else once specialized; here nothing else is open, so the case
+// measures the walk of /proc/self/fd and the close_range calls over the gaps.
+static void bench_fds() {
+    std::vector<int> opened;
+    for (int i = 0; i < 100; i++) {
+        int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) opened.push_back(fd);
+    }
+    bench::Run("for_each_open_fd + close_fds_except 100 fds", [] {
+        std::vector<int> allowed;
+        for_each_open_fd([&](int fd) { allowed.push_back(fd); });
+        std::sort(allowed.begin(), allowed.end());
+        close_fds_except(allowed);
+        bench::DoNotOptimize(allowed.size());
+    });
+    for (int fd : opened) close(fd);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2) bench::SetFilter(argv[1]);
+    bench_elf_img();
+    bench_maps();
+    bench_socket_utils();
+    bench_path_regex();
+    bench_fds();
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "arena.hpp"
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include "logging.hpp"
+
+namespace arena {
+
+// Modules may call into the API from their own threads, so the top only moves by CAS
+static uint8_t *base = nullptr;
+static std::atomic<size_t> top{0};
+
+static size_t align_up(size_t size) {
+    return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+}
+
+void Reset() {
+    if (base == nullptr) {
+        // Only the pages touched by the largest fork ever get committed
+        void *addr = mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED) {
+            PLOGE("map arena");
+            return;
+        }
+        base = static_cast<uint8_t *>(addr);
+    }
+    top.store(0, std::memory_order_relaxed);
+}
+
+void *Impl::allocate(size_t size) {
+    size_t offset = top.load(std::memory_order_relaxed);
+    while (base != nullptr) {
+        size_t start = align_up(offset);
+        if (start > kSize || kSize - start < size) break;
+        if (top.compare_exchange_weak(offset, start + size, std::memory_order_relaxed)) {
+            return base + start;
+        }
+    }
+    if (void *ptr = malloc(size ?: 1)) return ptr;
+    LOGE("out of memory allocating %zu bytes", size);
+    abort();
+}
+
+void Impl::deallocate(void *ptr, size_t size) {
+    auto *addr = static_cast<uint8_t *>(ptr);
+    if (base == nullptr || addr < base || addr >= base + kSize) {
+        free(ptr);
+        return;
+    }
+    size_t end = addr - base + size;
+    top.compare_exchange_strong(end, addr - base, std::memory_order_relaxed);
+}
+
+}  // namespace arena
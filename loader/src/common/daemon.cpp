@@ -1,7 +1,9 @@
 #include "daemon.hpp"
 
 #include <linux/un.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "logging.hpp"
@@ -13,13 +15,12 @@ void Init(const char *path) { TMP_PATH = path; }
 
 std::string GetTmpPath() { return TMP_PATH; }
 
-int Connect(uint8_t retry) {
+static int ConnectPath(const std::string &socket_path, uint8_t retry) {
     int fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     struct sockaddr_un addr{
         .sun_family = AF_UNIX,
         .sun_path = {0},
     };
-    auto socket_path = TMP_PATH + kCPSocketName;
     strcpy(addr.sun_path, socket_path.c_str());
     socklen_t socklen = sizeof(addr);
 
@@ -36,14 +37,15 @@ int Connect(uint8_t retry) {
     return -1;
 }
 
+int Connect(uint8_t retry) { return ConnectPath(TMP_PATH + kCPSocketName, retry); }
+
 bool PingHeartbeat() {
     UniqueFd fd = Connect(5);
     if (fd == -1) {
         PLOGE("Connect to zygiskd");
         return false;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::PingHeartbeat);
-    return true;
+    return socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::PingHeartbeat).flush();
 }
 
 uint32_t GetProcessFlags(uid_t uid) {
@@ -52,8 +54,7 @@ uint32_t GetProcessFlags(uid_t uid) {
         PLOGE("GetProcessFlags");
         return 0;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::GetProcessFlags);
-    socket_utils::write_u32(fd, uid);
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::GetProcessFlags).u32(uid).flush();
     return socket_utils::read_u32(fd);
 }
 
@@ -61,9 +62,67 @@ void CacheMountNamespace(pid_t pid) {
     UniqueFd fd = Connect(1);
     if (fd == -1) {
         PLOGE("CacheMountNamespace");
+        return;
+    }
+    socket_utils::FrameWriter(fd)
+        .u8((uint8_t) SocketAction::CacheMountNamespace)
+        .u32((uint32_t) pid)
+        .flush();
+}
+
+static std::string ReadMountNamespacePath(socket_utils::FrameReader &reader) {
+    uint32_t target_pid = reader.u32();
+    int target_fd = (int) reader.u32();
+    if (target_fd == 0) return "";
+    return "/proc/" + std::to_string(target_pid) + "/fd/" + std::to_string(target_fd);
+}
+
+// The module entries come as one blob, followed by the fds of all modules and then those
+// of their RELRO sections, see write_modules in zygiskd
+static void ReadModuleList(int fd, size_t blob_size, arena::Vector<Module> &modules) {
+    arena::Vector<char> blob(blob_size);
+    if (socket_utils::xread(fd, blob.data(), blob.size()) != (ssize_t) blob.size()) return;
+
+    size_t offset = 0;
+    auto take = [&](void *out, size_t size) {
+        if (blob.size() - offset < size) return false;
+        memcpy(out, blob.data() + offset, size);
+        offset += size;
+        return true;
+    };
+    size_t len = 0, relro_count = 0;
+    if (!take(&len, sizeof(len))) return;
+    for (size_t i = 0; i < len; i++) {
+        size_t index, name_len;
+        uint32_t flags;
+        RelroMode relro_mode;
+        if (!take(&index, sizeof(index)) || !take(&flags, sizeof(flags)) ||
+            !take(&relro_mode, sizeof(relro_mode)) || !take(&name_len, sizeof(name_len)) ||
+            blob.size() - offset < name_len) {
+            break;
+        }
+        std::string name(blob.data() + offset, name_len);
+        auto &module = modules.emplace_back(index, std::move(name), flags, -1);
+        offset += name_len;
+        module.relro_mode = relro_mode;
+        if (relro_mode != RelroMode::None) relro_count++;
+    }
+
+    if (modules.size() != len) {
+        modules.clear();
+        return;
+    }
+    auto fds = socket_utils::recv_fds(fd, len + relro_count);
+    if (fds.size() != len + relro_count) {
+        for (int module_fd : fds) close(module_fd);
+        modules.clear();
+        return;
+    }
+    auto next_relro_fd = fds.begin() + len;
+    for (size_t i = 0; i < len; i++) {
+        modules[i].memfd = fds[i];
+        if (modules[i].relro_mode != RelroMode::None) modules[i].relro_fd = *next_relro_fd++;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::CacheMountNamespace);
-    socket_utils::write_u32(fd, (uint32_t) pid);
 }
 
 std::string UpdateMountNamespace(MountNamespace type) {
@@ -72,39 +131,44 @@ std::string UpdateMountNamespace(MountNamespace type) {
         PLOGE("UpdateMountNamespace");
         return "";
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::UpdateMountNamespace);
-    socket_utils::write_u8(fd, (uint8_t) type);
-    uint32_t target_pid = socket_utils::read_u32(fd);
-    int target_fd = (int) socket_utils::read_u32(fd);
-    if (target_fd == 0) return "";
-    return "/proc/" + std::to_string(target_pid) + "/fd/" + std::to_string(target_fd);
+    socket_utils::FrameWriter(fd)
+        .u8((uint8_t) SocketAction::UpdateMountNamespace)
+        .u8((uint8_t) type)
+        .flush();
+    socket_utils::FrameReader reader(fd);
+    if (!reader.fill(2 * sizeof(uint32_t))) return "";
+    return ReadMountNamespacePath(reader);
 }
 
-std::vector<Module> ReadModules() {
-    std::vector<Module> modules;
+arena::Vector<Module> ReadModules() {
+    arena::Vector<Module> modules;
     UniqueFd fd = Connect(1);
     if (fd == -1) {
         PLOGE("ReadModules");
         return modules;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::ReadModules);
-    size_t len = socket_utils::read_usize(fd);
-    for (size_t i = 0; i < len; i++) {
-        std::string name = socket_utils::read_string(fd);
-        int module_fd = socket_utils::recv_fd(fd);
-        modules.emplace_back(name, module_fd);
-    }
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::ReadModules).flush();
+    ReadModuleList(fd, socket_utils::read_usize(fd), modules);
     return modules;
 }
 
 int ConnectCompanion(size_t index) {
+    // A running companion accepts requests itself, saving the round trip through zygiskd
+    auto companion_path = TMP_PATH + kCompanionSocketPrefix + std::to_string(index) + ".sock";
+    if (int fd = ConnectPath(companion_path, 1); fd != -1) {
+        if (socket_utils::read_u8(fd) == 1) return fd;
+        close(fd);
+    }
+
     int fd = Connect(1);
     if (fd == -1) {
         PLOGE("ConnectCompanion");
         return -1;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::RequestCompanionSocket);
-    socket_utils::write_usize(fd, index);
+    socket_utils::FrameWriter(fd)
+        .u8((uint8_t) SocketAction::RequestCompanionSocket)
+        .usize(index)
+        .flush();
     if (socket_utils::read_u8(fd) == 1) {
         return fd;
     } else {
@@ -119,8 +183,7 @@ int GetModuleDir(size_t index) {
         PLOGE("GetModuleDir");
         return -1;
     }
-    socket_utils::write_u8(fd, (uint8_t) SocketAction::GetModuleDir);
-    socket_utils::write_usize(fd, index);
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::GetModuleDir).usize(index).flush();
     return socket_utils::recv_fd(fd);
 }
 
@@ -134,7 +197,7 @@ void ZygoteRestart() {
         }
         return;
     }
-    if (!socket_utils::write_u8(fd, (uint8_t) SocketAction::ZygoteRestart)) {
+    if (!socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::ZygoteRestart).flush()) {
         PLOGE("Failed to request ZygoteRestart");
     }
 }
@@ -144,9 +207,231 @@ void SystemServerStarted() {
     if (fd == -1) {
         PLOGE("Failed to report system server started");
     } else {
-        if (!socket_utils::write_u8(fd, (uint8_t) SocketAction::SystemServerStarted)) {
+        auto action = (uint8_t) SocketAction::SystemServerStarted;
+        if (!socket_utils::FrameWriter(fd).u8(action).flush()) {
             PLOGE("Failed to report system server started");
         }
     }
 }
+
+SpecializeInfo GetSpecializeInfo(uid_t uid, bool is_system_server) {
+    UniqueFd fd = RequestSpecializeInfo(uid, is_system_server);
+    if (fd == -1) return {};
+    return ReadSpecializeInfo(fd);
+}
+
+int RequestSpecializeInfo(uid_t uid, bool is_system_server) {
+    int fd = Connect(1);
+    if (fd == -1) {
+        PLOGE("GetSpecializeInfo");
+        return -1;
+    }
+    if (!socket_utils::FrameWriter(fd)
+             .u8((uint8_t) SocketAction::GetSpecializeInfo)
+             .u32(uid)
+             .u8(is_system_server)
+             .flush()) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+SpecializeInfo ReadSpecializeInfo(int fd) {
+    SpecializeInfo info;
+    // Everything before the module list has a fixed size
+    socket_utils::FrameReader reader(fd);
+    if (!reader.fill(3 * sizeof(uint32_t) + sizeof(uint8_t) + sizeof(size_t))) return info;
+    info.flags = reader.u32();
+    info.mount_namespace = (MountNamespace) reader.u8();
+    info.mount_namespace_path = ReadMountNamespacePath(reader);
+    ReadModuleList(fd, reader.usize(), info.modules);
+    return info;
+}
+
+void ReportModuleRelro(size_t index, bool success) {
+    UniqueFd fd = Connect(1);
+    if (fd == -1) {
+        PLOGE("ReportModuleRelro");
+        return;
+    }
+    socket_utils::FrameWriter(fd)
+        .u8((uint8_t) SocketAction::ReportModuleRelro)
+        .usize(index)
+        .u8(success)
+        .flush();
+}
+
+std::string GetLinkerCache() {
+    UniqueFd fd = Connect(1);
+    if (fd == -1) {
+        PLOGE("GetLinkerCache");
+        return "";
+    }
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::GetLinkerCache).flush();
+    size_t len = socket_utils::read_usize(fd);
+    std::string data(len, '\0');
+    if (len > 0 && socket_utils::xread(fd, data.data(), len) != (ssize_t) len) return "";
+    return data;
+}
+
+void SaveLinkerCache(std::string_view data) {
+    UniqueFd fd = Connect(1);
+    if (fd == -1) {
+        PLOGE("SaveLinkerCache");
+        return;
+    }
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::SaveLinkerCache).string(data).flush();
+}
+
+int ConnectTimingReport() {
+    int fd = Connect(1);
+    // The action goes first, the accept loop of zygiskd blocks until it reads one
+    if (fd == -1 ||
+        !socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::ReportTimings).flush()) {
+        PLOGE("ReportTimings");
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ReportTimings(int fd, bool is_system_server, uid_t uid, std::string_view samples,
+                   std::string_view modules) {
+    socket_utils::FrameWriter(fd)
+        .u8(is_system_server)
+        .u32(uid)
+        .string(samples)
+        .string(modules)
+        .flush();
+}
+
+// Each ABI has its own zygiskd and apps report to the one of theirs, so the controls of
+// zygisk-ctl.sh go to both. The one of the other ABI is missing on 64-bit only devices.
+static constexpr const char *kDaemonSocketNames[] = {"/cp64.sock", "/cp32.sock"};
+
+template <typename F>
+static bool ForEachDaemon(F &&fn) {
+    bool reached = false;
+    for (auto *name : kDaemonSocketNames) {
+        UniqueFd fd = ConnectPath(TMP_PATH + name, 1);
+        if (fd == -1) continue;
+        reached = true;
+        fn(name, fd);
+    }
+    return reached;
+}
+
+std::string GetTimingStats() {
+    std::string stats;
+    bool reached = ForEachDaemon([&](const char *name, int fd) {
+        socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::GetTimingStats).flush();
+        std::string report = socket_utils::read_string(fd);
+        if (report.empty()) return;
+        stats += name == kDaemonSocketNames[0] ? "zygiskd64:\n" : "zygiskd32:\n";
+        stats += report;
+    });
+    if (!reached) PLOGE("GetTimingStats");
+    return stats;
+}
+
+void SetScopedOutUids(const std::vector<uint32_t> &uids) {
+    bool reached = ForEachDaemon([&](const char *, int fd) {
+        socket_utils::FrameWriter(fd)
+            .u8((uint8_t) SocketAction::SetScopedOutUids)
+            .string({reinterpret_cast<const char *>(uids.data()), uids.size() * sizeof(uint32_t)})
+            .flush();
+        // Acknowledged once the flags table no longer caches module counts of these uids
+        socket_utils::read_u8(fd);
+    });
+    if (!reached) PLOGE("SetScopedOutUids");
+}
+
+uint32_t TakeSpecializeLatency(uid_t uid) {
+    uint32_t latency = 0;
+    // Taken from both, so that neither keeps a latency for a later launch
+    bool reached = ForEachDaemon([&](const char *, int fd) {
+        socket_utils::FrameWriter(fd)
+            .u8((uint8_t) SocketAction::TakeSpecializeLatency)
+            .u32(uid)
+            .flush();
+        if (uint32_t taken = socket_utils::read_u32(fd)) latency = taken;
+    });
+    if (!reached) PLOGE("TakeSpecializeLatency");
+    return latency;
+}
+
+bool FlagsTable::Map() {
+    UniqueFd fd = Connect(1);
+    if (fd == -1) {
+        PLOGE("GetFlagsTable");
+        return false;
+    }
+    socket_utils::FrameWriter(fd).u8((uint8_t) SocketAction::GetFlagsTable).flush();
+    if (socket_utils::read_u8(fd) != 1) return false;
+    UniqueFd table_fd = socket_utils::recv_fd(fd);
+
+    struct stat st;
+    if (table_fd == -1 || fstat(table_fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+        return false;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, table_fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOGE("mmap flags table");
+        return false;
+    }
+    auto *header = static_cast<const Header *>(addr);
+    if (header->magic != kMagic ||
+        sizeof(Header) + header->capacity * sizeof(Entry) > (size_t) st.st_size) {
+        LOGE("invalid flags table");
+        munmap(addr, st.st_size);
+        return false;
+    }
+    header_ = header;
+    entries_ = reinterpret_cast<const Entry *>(header + 1);
+    size_ = st.st_size;
+    return true;
+}
+
+void FlagsTable::Unmap() {
+    if (header_ == nullptr) return;
+    munmap(const_cast<Header *>(header_), size_);
+    header_ = nullptr;
+    entries_ = nullptr;
+}
+
+bool FlagsTable::Lookup(uid_t uid, uint32_t &flags, uint32_t &modules) const {
+    if (header_ == nullptr) return false;
+    uint32_t generation = __atomic_load_n(&header_->generation, __ATOMIC_ACQUIRE);
+    uint32_t start = (static_cast<uint32_t>(uid) * 0x9e3779b1u) >> 21;
+    for (uint32_t i = 0; i < kMaxProbes; i++) {
+        const Entry &entry = entries_[(start + i) % header_->capacity];
+        uint32_t sequence = __atomic_load_n(&entry.sequence, __ATOMIC_ACQUIRE);
+        if (sequence == 0 || (sequence & 1)) continue;
+        uint32_t entry_uid = __atomic_load_n(&entry.uid, __ATOMIC_RELAXED);
+        uint32_t entry_flags = __atomic_load_n(&entry.flags, __ATOMIC_RELAXED);
+        uint32_t entry_modules = __atomic_load_n(&entry.modules, __ATOMIC_RELAXED);
+        uint32_t entry_generation = __atomic_load_n(&entry.generation, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry.sequence, __ATOMIC_RELAXED) != sequence) continue;
+        if (entry_uid == uid && entry_generation == generation) {
+            flags = entry_flags;
+            modules = entry_modules;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string FlagsTable::MountNamespacePath(MountNamespace type) const {
+    if (header_ == nullptr) return "";
+    uint32_t fd = __atomic_load_n(&header_->mount_namespace_fds[(int) type], __ATOMIC_ACQUIRE);
+    if (fd == 0) return "";
+    return "/proc/" + std::to_string(header_->daemon_pid) + "/fd/" + std::to_string(fd);
+}
+
+uint32_t FlagsTable::MountNamespaceGeneration() const {
+    if (header_ == nullptr) return 0;
+    return __atomic_load_n(&header_->mount_namespace_generation, __ATOMIC_ACQUIRE);
+}
 }  // namespace zygiskd
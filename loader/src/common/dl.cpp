@@ -2,7 +2,15 @@
 
 #include <android/dlext.h>
 #include <dlfcn.h>
+#include <elf.h>
 #include <libgen.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 #include "logging.hpp"
 
@@ -59,3 +67,198 @@ void* DlopenMem(int fd, int flags) {
     }
     return handle;
 }
+
+void* DlopenMem(int fd, int flags, void* reserved_addr, size_t reserved_size, int relro_fd,
+                bool write_relro) {
+    auto info = android_dlextinfo{
+        .flags = ANDROID_DLEXT_USE_LIBRARY_FD | ANDROID_DLEXT_RESERVED_ADDRESS,
+        .reserved_addr = reserved_addr,
+        .reserved_size = reserved_size,
+        .relro_fd = relro_fd,
+        .library_fd = fd,
+        .library_fd_offset = 0,
+        .library_namespace = nullptr};
+    if (relro_fd >= 0) {
+        info.flags |= write_relro ? ANDROID_DLEXT_WRITE_RELRO : ANDROID_DLEXT_USE_RELRO;
+    }
+
+    auto* handle = android_dlopen_ext("/jit-cache-zygisk", flags, &info);
+    if (handle) {
+        LOGV("dlopen fd %d at %p (relro fd %d, write %d): %p", fd, reserved_addr, relro_fd,
+             write_relro, handle);
+    } else {
+        LOGE("dlopen fd %d at %p: %s", fd, reserved_addr, dlerror());
+    }
+    return handle;
+}
+
+size_t GetLoadSize(int fd) {
+    ElfW(Ehdr) ehdr;
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_phentsize != sizeof(ElfW(Phdr))) {
+        return 0;
+    }
+
+    std::vector<ElfW(Phdr)> phdrs(ehdr.e_phnum);
+    auto phdrs_size = static_cast<ssize_t>(phdrs.size() * sizeof(ElfW(Phdr)));
+    if (pread(fd, phdrs.data(), phdrs_size, ehdr.e_phoff) != phdrs_size) return 0;
+
+    // Same rounding as the linker, with the largest segment alignment it may honor
+    uintptr_t align = getpagesize();
+    uintptr_t min_vaddr = UINTPTR_MAX;
+    uintptr_t max_vaddr = 0;
+    for (auto& phdr : phdrs) {
+        if (phdr.p_type != PT_LOAD) continue;
+        min_vaddr = std::min<uintptr_t>(min_vaddr, phdr.p_vaddr);
+        max_vaddr = std::max<uintptr_t>(max_vaddr, phdr.p_vaddr + phdr.p_memsz);
+        align = std::max<uintptr_t>(align, phdr.p_align);
+    }
+    if (min_vaddr > max_vaddr) return 0;
+
+    min_vaddr &= ~(align - 1);
+    max_vaddr = (max_vaddr + align - 1) & ~(align - 1);
+    return max_vaddr - min_vaddr;
+}
+
+struct RegionsQuery {
+    uintptr_t addr;
+    bool skip_relro;
+    std::vector<MappedRegion>* regions;
+};
+
+void GetLibraryRegions(const void* addr, bool skip_relro, std::vector<MappedRegion>& regions) {
+    RegionsQuery query{reinterpret_cast<uintptr_t>(addr), skip_relro, &regions};
+    dl_iterate_phdr(
+        [](struct dl_phdr_info* info, size_t, void* data) -> int {
+            auto* query = reinterpret_cast<RegionsQuery*>(data);
+            uintptr_t page_size = getpagesize();
+            auto page_start = [=](uintptr_t v) { return v & ~(page_size - 1); };
+            auto page_end = [=](uintptr_t v) { return (v + page_size - 1) & ~(page_size - 1); };
+
+            bool contains = false;
+            uintptr_t relro_start = 0, relro_end = 0;
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+                const auto& phdr = info->dlpi_phdr[i];
+                uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+                if (phdr.p_type == PT_LOAD && query->addr >= start &&
+                    query->addr < start + phdr.p_memsz) {
+                    contains = true;
+                } else if (phdr.p_type == PT_GNU_RELRO) {
+                    relro_start = page_start(start);
+                    relro_end = page_end(start + phdr.p_memsz);
+                }
+            }
+            if (!contains) return 0;
+
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+                const auto& phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_LOAD || phdr.p_filesz == 0) continue;
+                uintptr_t start = page_start(info->dlpi_addr + phdr.p_vaddr);
+                uintptr_t end = page_end(info->dlpi_addr + phdr.p_vaddr + phdr.p_filesz);
+                int perms = ((phdr.p_flags & PF_R) ? PROT_READ : 0) |
+                            ((phdr.p_flags & PF_W) ? PROT_WRITE : 0) |
+                            ((phdr.p_flags & PF_X) ? PROT_EXEC : 0);
+                // Split off the part made read-only after relocation
+                uintptr_t lo = std::clamp(relro_start, start, end);
+                uintptr_t hi = std::clamp(relro_end, start, end);
+                if (start < lo) query->regions->push_back({start, lo, perms});
+                if (lo < hi && !query->skip_relro) query->regions->push_back({lo, hi, PROT_READ});
+                if (hi < end) query->regions->push_back({hi, end, perms});
+            }
+            return 1;
+        },
+        &query);
+}
+
+struct GotSlotsQuery {
+    uintptr_t base;
+    std::string_view symbol;
+    uintptr_t value;
+    std::vector<GotSlot>* slots;
+};
+
+#ifdef __LP64__
+using DynamicReloc = ElfW(Rela);
+#define RELOC_SYM ELF64_R_SYM
+#else
+using DynamicReloc = ElfW(Rel);
+#define RELOC_SYM ELF32_R_SYM
+#endif
+
+void FindGotSlots(uintptr_t base, std::string_view symbol, uintptr_t value,
+                  std::vector<GotSlot>& slots) {
+    GotSlotsQuery query{base, symbol, value, &slots};
+    dl_iterate_phdr(
+        [](struct dl_phdr_info* info, size_t, void* data) -> int {
+            auto* query = reinterpret_cast<GotSlotsQuery*>(data);
+            const ElfW(Dyn)* dynamic = nullptr;
+            bool contains = false;
+            uintptr_t relro_start = 0, relro_end = 0;
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+                const auto& phdr = info->dlpi_phdr[i];
+                uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+                if (phdr.p_type == PT_LOAD && query->base >= (start & ~(getpagesize() - 1)) &&
+                    query->base < start + phdr.p_memsz) {
+                    contains = true;
+                } else if (phdr.p_type == PT_DYNAMIC) {
+                    dynamic = reinterpret_cast<const ElfW(Dyn)*>(start);
+                } else if (phdr.p_type == PT_GNU_RELRO) {
+                    relro_start = start;
+                    relro_end = start + phdr.p_memsz;
+                }
+            }
+            if (!contains || dynamic == nullptr) return contains;
+
+            // Bionic leaves the dynamic section unrelocated
+            const ElfW(Sym)* symtab = nullptr;
+            const char* strtab = nullptr;
+            std::pair<const DynamicReloc*, size_t> tables[2] = {};
+            for (auto* d = dynamic; d->d_tag != DT_NULL; d++) {
+                uintptr_t ptr = info->dlpi_addr + d->d_un.d_ptr;
+                switch (d->d_tag) {
+                case DT_SYMTAB:
+                    symtab = reinterpret_cast<const ElfW(Sym)*>(ptr);
+                    break;
+                case DT_STRTAB:
+                    strtab = reinterpret_cast<const char*>(ptr);
+                    break;
+                case DT_JMPREL:
+                    tables[0].first = reinterpret_cast<const DynamicReloc*>(ptr);
+                    break;
+                case DT_PLTRELSZ:
+                    tables[0].second = d->d_un.d_val / sizeof(DynamicReloc);
+                    break;
+#ifdef __LP64__
+                case DT_RELA:
+#else
+                case DT_REL:
+#endif
+                    tables[1].first = reinterpret_cast<const DynamicReloc*>(ptr);
+                    break;
+#ifdef __LP64__
+                case DT_RELASZ:
+#else
+                case DT_RELSZ:
+#endif
+                    tables[1].second = d->d_un.d_val / sizeof(DynamicReloc);
+                    break;
+                }
+            }
+            if (symtab == nullptr || strtab == nullptr) return 1;
+
+            for (auto [relocs, count] : tables) {
+                if (relocs == nullptr) continue;
+                for (size_t i = 0; i < count; i++) {
+                    auto sym = RELOC_SYM(relocs[i].r_info);
+                    if (sym == 0 || query->symbol != strtab + symtab[sym].st_name) continue;
+                    uintptr_t addr = info->dlpi_addr + relocs[i].r_offset;
+                    if (*reinterpret_cast<uintptr_t*>(addr) != query->value) continue;
+                    bool relro = addr >= relro_start && addr < relro_end;
+                    query->slots->push_back(
+                        {addr, relro ? PROT_READ : PROT_READ | PROT_WRITE});
+                }
+            }
+            return 1;
+        },
+        &query);
+}
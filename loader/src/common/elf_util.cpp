@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
@@ -41,9 +42,14 @@ ElfImg::ElfImg(std::string_view base_name) : elf(base_name) {
         base = nullptr;
         return;
     }
+    parse();
+}
+
+ElfImg::ElfImg(std::string_view path, void *base) : elf(path), base(base) { parse(); }
 
+void ElfImg::parse() {
     // load elf
-    int fd = open(elf.data(), O_RDONLY);
+    int fd = open(elf.data(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         // LOGE("failed to open %s", elf.data());
         return;
@@ -54,10 +60,16 @@ ElfImg::ElfImg(std::string_view base_name) : elf(base_name) {
         // LOGE("lseek() failed for %s", elf.data());
     }
 
-    header = reinterpret_cast<decltype(header)>(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0));
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
 
     close(fd);
 
+    if (addr == MAP_FAILED) {
+        base = nullptr;
+        return;
+    }
+    header = reinterpret_cast<decltype(header)>(addr);
+
     section_header = offsetOf<decltype(section_header)>(header, header->e_shoff);
 
     auto shoff = reinterpret_cast<uintptr_t>(section_header);
@@ -164,22 +176,33 @@ ElfW(Addr) ElfImg::GnuLookup(std::string_view name, uint32_t hash) const {
     return 0;
 }
 
-ElfW(Addr) ElfImg::LinearLookup(std::string_view name) const {
-    if (symtabs_.empty()) {
-        symtabs_.reserve(symtab_count);
-        if (symtab_start != nullptr && symstr_offset_for_symtab != 0) {
-            for (ElfW(Off) i = 0; i < symtab_count; i++) {
-                unsigned int st_type = ELF_ST_TYPE(symtab_start[i].st_info);
-                const char *st_name = offsetOf<const char *>(
-                    header, symstr_offset_for_symtab + symtab_start[i].st_name);
-                if ((st_type == STT_FUNC || st_type == STT_OBJECT) && symtab_start[i].st_size) {
-                    symtabs_.emplace(st_name, &symtab_start[i]);
-                }
-            }
+void ElfImg::BuildSymtabIndex() const {
+    if (!symtabs_.empty() || symtab_start == nullptr || symstr_offset_for_symtab == 0) return;
+
+    symtabs_.reserve(symtab_count);
+    for (ElfW(Off) i = 0; i < symtab_count; i++) {
+        unsigned int st_type = ELF_ST_TYPE(symtab_start[i].st_info);
+        const char *st_name =
+            offsetOf<const char *>(header, symstr_offset_for_symtab + symtab_start[i].st_name);
+        if ((st_type == STT_FUNC || st_type == STT_OBJECT) && symtab_start[i].st_size) {
+            symtabs_.emplace_back(st_name, &symtab_start[i]);
         }
     }
+    // Stable so that the first of duplicated names wins
+    std::stable_sort(symtabs_.begin(), symtabs_.end(),
+                     [](const auto &a, const auto &b) { return a.first < b.first; });
+    symtabs_.shrink_to_fit();
+}
+
+static auto LowerBound(const std::vector<std::pair<std::string_view, ElfW(Sym) *>> &symtabs,
+                       std::string_view name) {
+    return std::lower_bound(symtabs.begin(), symtabs.end(), name,
+                            [](const auto &entry, std::string_view n) { return entry.first < n; });
+}
 
-    if (auto i = symtabs_.find(name); i != symtabs_.end()) {
+ElfW(Addr) ElfImg::LinearLookup(std::string_view name) const {
+    BuildSymtabIndex();
+    if (auto i = LowerBound(symtabs_, name); i != symtabs_.end() && i->first == name) {
         return i->second->st_value;
     } else {
         return 0;
@@ -187,30 +210,57 @@ ElfW(Addr) ElfImg::LinearLookup(std::string_view name) const {
 }
 
 std::string_view ElfImg::LinearLookupByPrefix(std::string_view name) const {
-    if (symtabs_.empty()) {
-        symtabs_.reserve(symtab_count);
-        if (symtab_start != nullptr && symstr_offset_for_symtab != 0) {
-            for (ElfW(Off) i = 0; i < symtab_count; i++) {
-                unsigned int st_type = ELF_ST_TYPE(symtab_start[i].st_info);
-                const char *st_name = offsetOf<const char *>(
-                    header, symstr_offset_for_symtab + symtab_start[i].st_name);
-                if ((st_type == STT_FUNC || st_type == STT_OBJECT) && symtab_start[i].st_size) {
-                    symtabs_.emplace(st_name, &symtab_start[i]);
-                }
-            }
-        }
+    BuildSymtabIndex();
+    // All names sharing the prefix sort right after it
+    if (auto i = LowerBound(symtabs_, name); i != symtabs_.end() && i->first.starts_with(name)) {
+        return i->first;
     }
+    return "";
+}
 
-    auto size = name.size();
-    for (auto symtab : symtabs_) {
-        if (symtab.first.size() < size) continue;
+void ElfImg::resolve(std::span<SymbolQuery> queries) const {
+    auto to_address = [this](ElfW(Addr) offset) -> ElfW(Addr) {
+        if (offset == 0 || base == nullptr) return 0;
+        return static_cast<ElfW(Addr)>((uintptr_t) base + offset - bias);
+    };
 
-        if (symtab.first.substr(0, size) == name) {
-            return symtab.first;
+    size_t pending = 0;
+    for (auto &query : queries) {
+        query.symbol = {};
+        query.address = 0;
+        if (!query.prefix) {
+            if (auto offset = GnuLookup(query.name, query.gnu_hash); offset > 0) {
+                query.address = to_address(offset);
+            } else if (offset = ElfLookup(query.name, query.elf_hash); offset > 0) {
+                query.address = to_address(offset);
+            }
+            if (query.address != 0) {
+                // Hash lookups only match the whole name
+                query.symbol = query.name;
+                continue;
+            }
         }
+        pending++;
     }
+    if (pending == 0 || symtab_start == nullptr || symstr_offset_for_symtab == 0) return;
 
-    return "";
+    for (ElfW(Off) i = 0; i < symtab_count && pending > 0; i++) {
+        unsigned int st_type = ELF_ST_TYPE(symtab_start[i].st_info);
+        if ((st_type != STT_FUNC && st_type != STT_OBJECT) || symtab_start[i].st_size == 0) {
+            continue;
+        }
+        const char *st_name =
+            offsetOf<const char *>(header, symstr_offset_for_symtab + symtab_start[i].st_name);
+        for (auto &query : queries) {
+            if (query.address != 0 || strncmp(st_name, query.name.data(), query.name.size()) != 0) {
+                continue;
+            }
+            if (!query.prefix && st_name[query.name.size()] != '\0') continue;
+            query.symbol = st_name;
+            query.address = to_address(symtab_start[i].st_value);
+            if (query.address != 0) pending--;
+        }
+    }
 }
 
 ElfImg::~ElfImg() {
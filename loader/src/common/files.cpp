@@ -1,6 +1,16 @@
 #include "files.hpp"
 
+#include <sys/syscall.h>
 #include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "misc.hpp"
+
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
 
 using namespace std::string_view_literals;
 
@@ -35,3 +45,41 @@ sDIR make_dir(DIR *dp) {
 sFILE make_file(FILE *fp) {
     return sFILE(fp, [](FILE *fp) { return fp ? fclose(fp) : 1; });
 }
+
+void for_each_open_fd(const std::function<void(int)> &fn) {
+    auto dir = open_dir("/proc/self/fd");
+    if (!dir) return;
+    int dfd = dirfd(dir.get());
+    for (dirent *entry; (entry = readdir(dir.get()));) {
+        int fd = parse_int(entry->d_name);
+        if (fd >= 0 && fd != dfd) fn(fd);
+    }
+}
+
+static bool close_range_gaps(std::span<const int> keep) {
+    unsigned int first = 0;
+    for (int fd : keep) {
+        if (fd < 0 || static_cast<unsigned int>(fd) < first) continue;
+        if (static_cast<unsigned int>(fd) > first &&
+            syscall(__NR_close_range, first, fd - 1, 0) != 0) {
+            return false;
+        }
+        first = fd + 1;
+    }
+    return syscall(__NR_close_range, first, ~0U, 0) == 0;
+}
+
+void close_fds_except(std::span<const int> keep) {
+    // close_range is only available since Linux 5.9
+    if (close_range_gaps(keep)) return;
+
+    auto dir = open_dir("/proc/self/fd");
+    if (!dir) return;
+    int dfd = dirfd(dir.get());
+    for (dirent *entry; (entry = readdir(dir.get()));) {
+        int fd = parse_int(entry->d_name);
+        if (fd >= 0 && fd != dfd && !std::binary_search(keep.begin(), keep.end(), fd)) {
+            close(fd);
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#include "maps.hpp"
+
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+static const char *maps_path(pid_t pid, char (&path)[32]) {
+    if (pid == 0) return "/proc/self/maps";
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    return path;
+}
+
+MapsReader::MapsReader(pid_t pid) {
+    char path[32];
+    fd_ = open(maps_path(pid, path), O_RDONLY | O_CLOEXEC);
+}
+
+MapsReader::MapsReader(const char *path) { fd_ = open(path, O_RDONLY | O_CLOEXEC); }
+
+MapsReader::~MapsReader() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool MapsReader::NextLine(std::string_view &line) {
+    bool overlong = false;
+    while (true) {
+        if (auto *nl = static_cast<char *>(memchr(buf_ + begin_, '\n', end_ - begin_))) {
+            size_t len = nl - (buf_ + begin_);
+            line = {buf_ + begin_, len};
+            begin_ += len + 1;
+            if (!overlong) return true;
+            overlong = false;
+            continue;
+        }
+        if (eof_ || fd_ < 0) {
+            if (begin_ == end_ || overlong) return false;
+            // The last line is not terminated
+            line = {buf_ + begin_, end_ - begin_};
+            begin_ = end_;
+            return true;
+        }
+        if (begin_ > 0) {
+            memmove(buf_, buf_ + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == sizeof(buf_)) {
+            // Skip lines that do not fit into the buffer
+            overlong = true;
+            begin_ = end_ = 0;
+        }
+        ssize_t n = read(fd_, buf_ + end_, sizeof(buf_) - end_);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            eof_ = true;
+        } else {
+            end_ += n;
+        }
+    }
+}
+
+static bool ParseHex(std::string_view &s, uintptr_t &value) {
+    size_t i = 0;
+    value = 0;
+    for (; i < s.size(); i++) {
+        char c = s[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            break;
+        }
+        value = (value << 4) | digit;
+    }
+    s.remove_prefix(i);
+    return i > 0;
+}
+
+static bool ParseDec(std::string_view &s, uintptr_t &value) {
+    size_t i = 0;
+    value = 0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++) {
+        value = value * 10 + (s[i] - '0');
+    }
+    s.remove_prefix(i);
+    return i > 0;
+}
+
+static bool Expect(std::string_view &s, char c) {
+    if (s.empty() || s[0] != c) return false;
+    s.remove_prefix(1);
+    return true;
+}
+
+// start-end perms offset major:minor inode [path]
+static bool ParseLine(std::string_view s, MapEntry &entry) {
+    uintptr_t major, minor, inode;
+    if (!ParseHex(s, entry.start) || !Expect(s, '-') || !ParseHex(s, entry.end) ||
+        !Expect(s, ' ') || s.size() < 5) {
+        return false;
+    }
+    entry.perms = 0;
+    if (s[0] == 'r') entry.perms |= PROT_READ;
+    if (s[1] == 'w') entry.perms |= PROT_WRITE;
+    if (s[2] == 'x') entry.perms |= PROT_EXEC;
+    entry.is_private = s[3] == 'p';
+    s.remove_prefix(4);
+    if (!Expect(s, ' ') || !ParseHex(s, entry.offset) || !Expect(s, ' ') ||
+        !ParseHex(s, major) || !Expect(s, ':') || !ParseHex(s, minor) || !Expect(s, ' ') ||
+        !ParseDec(s, inode)) {
+        return false;
+    }
+    entry.dev = makedev(major, minor);
+    entry.inode = inode;
+    size_t path_start = s.find_first_not_of(' ');
+    entry.path = path_start == std::string_view::npos ? std::string_view() : s.substr(path_start);
+    return true;
+}
+
+bool MapsReader::Next(MapEntry &entry) {
+    for (std::string_view line; NextLine(line);) {
+        if (ParseLine(line, entry)) return true;
+    }
+    return false;
+}
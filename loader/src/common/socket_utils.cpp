@@ -3,7 +3,10 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <vector>
 
 #include "logging.hpp"
 
@@ -97,11 +100,9 @@ size_t read_usize(int fd) { return read_exact_or<size_t>(fd, 0); }
 bool write_usize(int fd, size_t val) { return write_exact<size_t>(fd, val); }
 
 std::string read_string(int fd) {
-    auto len = read_usize(fd);
-    char* buf = new char[len + 1];
-    buf[len] = '\0';
-    xread(fd, buf, len);
-    return buf;
+    std::string str(read_usize(fd), '\0');
+    if (xread(fd, str.data(), str.size()) != (ssize_t) str.size()) return "";
+    return str;
 }
 
 bool write_u8(int fd, uint8_t val) { return write_exact<uint8_t>(fd, val); }
@@ -122,4 +123,77 @@ int recv_fd(int sockfd) {
     memcpy(&result, data, sizeof(int));
     return result;
 }
+
+// Most fds the kernel accepts in one SCM_RIGHTS message
+static constexpr size_t kScmMaxFd = 253;
+
+std::vector<int> recv_fds(int sockfd, size_t count) {
+    std::vector<int> fds;
+    fds.reserve(count);
+    while (fds.size() < count) {
+        size_t n = std::min(count - fds.size(), kScmMaxFd);
+        std::vector<char> cmsgbuf(CMSG_SPACE(sizeof(int) * n));
+        void* data = recv_fds(sockfd, cmsgbuf.data(), cmsgbuf.size(), n);
+        if (data == nullptr) {
+            for (int fd : fds) close(fd);
+            return {};
+        }
+        fds.resize(fds.size() + n);
+        memcpy(fds.data() + fds.size() - n, data, sizeof(int) * n);
+    }
+    return fds;
+}
+
+FrameWriter& FrameWriter::put(const void* data, size_t size) {
+    if (used_ + size > kCapacity || iovcnt_ == kMaxIov) flush();
+    memcpy(buf_ + used_, data, size);
+    // Extend the last segment if it ends where this field starts
+    if (iovcnt_ > 0 && (char*) iov_[iovcnt_ - 1].iov_base + iov_[iovcnt_ - 1].iov_len ==
+                           buf_ + used_) {
+        iov_[iovcnt_ - 1].iov_len += size;
+    } else {
+        iov_[iovcnt_++] = {buf_ + used_, size};
+    }
+    used_ += size;
+    return *this;
+}
+
+FrameWriter& FrameWriter::string(std::string_view str) {
+    usize(str.size());
+    if (str.empty()) return *this;
+    if (iovcnt_ == kMaxIov) flush();
+    iov_[iovcnt_++] = {const_cast<char*>(str.data()), str.size()};
+    return *this;
+}
+
+bool FrameWriter::flush() {
+    iovec* iov = iov_;
+    int iovcnt = iovcnt_;
+    while (iovcnt > 0) {
+        ssize_t ret = writev(fd_, iov, iovcnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            PLOGE("writev");
+            ok_ = false;
+            break;
+        }
+        // Skip what was written, resuming within a partially written segment
+        for (; iovcnt > 0 && (size_t) ret >= iov->iov_len; iov++, iovcnt--) ret -= iov->iov_len;
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    used_ = 0;
+    iovcnt_ = 0;
+    return ok_;
+}
+
+bool FrameReader::fill(size_t size) {
+    size_ = 0;
+    offset_ = 0;
+    if (size > kCapacity || xread(fd_, buf_, size) != (ssize_t) size) return false;
+    size_ = size;
+    return true;
+}
 }  // namespace socket_utils
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+#include "misc.hpp"
+
+// Bump allocator for the state of one specialization. Its mapping is set up in zygote and
+// rewound for every fork, children inherit it copy-on-write and never rewind it again.
+// Nothing allocated from it may outlive the ZygiskContext it was allocated for.
+namespace arena {
+
+// Zygote has about a hundred fds and a handful of modules, this leaves plenty of room
+constexpr size_t kSize = 256 * 1024;
+
+// Maps the arena on first use, then forgets everything allocated from it
+void Reset();
+
+struct Impl {
+    // Falls back to malloc once the arena is full
+    static void *allocate(size_t size);
+    // Only the latest allocation is given back to the arena, to let the last vector grow
+    static void deallocate(void *ptr, size_t size);
+};
+
+template <typename T>
+using Allocator = stateless_allocator<T, Impl>;
+
+template <typename T>
+using Vector = std::vector<T, Allocator<T>>;
+
+template <typename T>
+using List = std::list<T, Allocator<T>>;
+
+}  // namespace arena
@@ -6,6 +6,8 @@
 #include <string_view>
 #include <vector>
 
+#include "arena.hpp"
+
 #if defined(__LP64__)
 #define LP_SELECT(lp32, lp64) lp64
 #else
@@ -13,6 +15,8 @@
 #endif
 
 constexpr auto kCPSocketName = "/" LP_SELECT("cp32", "cp64") ".sock";
+// Followed by the module index, listened on by running companions
+constexpr auto kCompanionSocketPrefix = "/" LP_SELECT("cp32", "cp64") "-";
 
 class UniqueFd {
     using Fd = int;
@@ -48,11 +52,34 @@ private:
 
 namespace zygiskd {
 
+enum ModuleFlags : uint32_t {
+    // Loaded once in zygote and inherited by its children
+    ZYGOTE_RESIDENT = (1u << 0),
+    // PLT hook commits without backups to fill are applied once after all pre callbacks
+    DEFERRED_PLT_COMMIT = (1u << 1),
+    // connectCompanion hands out the same connection throughout a specialization
+    REUSE_COMPANION = (1u << 2),
+};
+
+enum class RelroMode : uint8_t {
+    None,
+    // Write the relocated RELRO section to relro_fd and report the result
+    Write,
+    // Map the shared RELRO section from relro_fd
+    Use,
+};
+
 struct Module {
+    // Index of the module in zygiskd, replies may only carry the modules targeting a process
+    size_t index;
     std::string name;
+    uint32_t flags;
     UniqueFd memfd;
+    RelroMode relro_mode = RelroMode::None;
+    UniqueFd relro_fd;
 
-    inline explicit Module(std::string name, int memfd) : name(name), memfd(memfd) {}
+    inline explicit Module(size_t index, std::string name, uint32_t flags, int memfd)
+        : index(index), name(name), flags(flags), memfd(memfd) {}
 };
 
 enum class SocketAction {
@@ -65,17 +92,73 @@ enum class SocketAction {
     GetModuleDir,
     ZygoteRestart,
     SystemServerStarted,
+    GetSpecializeInfo,
+    ReportModuleRelro,
+    GetFlagsTable,
+    GetLinkerCache,
+    SaveLinkerCache,
+    ReportTimings,
+    GetTimingStats,
+    SetScopedOutUids,
+    TakeSpecializeLatency,
 };
 
 enum class MountNamespace { Clean, Root, Module };
 
+// Everything a process needs from zygiskd to be specialized, fetched in a single round trip
+struct SpecializeInfo {
+    uint32_t flags = 0;
+    MountNamespace mount_namespace = MountNamespace::Clean;
+    // Empty if zygiskd has no cached namespace of the requested type yet
+    std::string mount_namespace_path;
+    arena::Vector<Module> modules;
+};
+
+// Read-only view of the uid to process flags table zygiskd shares, the layout matches
+// zygiskd/src/flags_table.rs. Lookups are lockless and miss on entries being written
+// or left over from an older generation.
+class FlagsTable {
+public:
+    bool Map();
+    void Unmap();
+    bool Lookup(uid_t uid, uint32_t &flags, uint32_t &modules) const;
+    std::string MountNamespacePath(MountNamespace type) const;
+    // 0 until zygiskd cached a namespace
+    uint32_t MountNamespaceGeneration() const;
+
+private:
+    static constexpr uint32_t kMagic = 0x5a594746;
+    static constexpr uint32_t kMaxProbes = 8;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t capacity;
+        uint32_t generation;
+        uint32_t daemon_pid;
+        uint32_t mount_namespace_fds[3];
+        uint32_t mount_namespace_generation;
+    };
+
+    struct Entry {
+        uint32_t sequence;
+        uint32_t uid;
+        uint32_t flags;
+        uint32_t modules;
+        uint32_t generation;
+    };
+
+    const Header *header_ = nullptr;
+    const Entry *entries_ = nullptr;
+    size_t size_ = 0;
+};
+
 void Init(const char* path);
 
 std::string GetTmpPath();
 
 bool PingHeartbeat();
 
-std::vector<Module> ReadModules();
+arena::Vector<Module> ReadModules();
 
 uint32_t GetProcessFlags(uid_t uid);
 
@@ -90,4 +173,36 @@ int GetModuleDir(size_t index);
 void ZygoteRestart();
 
 void SystemServerStarted();
+
+SpecializeInfo GetSpecializeInfo(uid_t uid, bool is_system_server);
+
+// GetSpecializeInfo split in two, so that zygiskd prepares the reply while the caller goes on.
+// The request returns the connection to read the reply from, or -1.
+int RequestSpecializeInfo(uid_t uid, bool is_system_server);
+SpecializeInfo ReadSpecializeInfo(int fd);
+
+void ReportModuleRelro(size_t index, bool success);
+
+// Opaque blob persisted by zygiskd, an empty string if none was saved
+std::string GetLinkerCache();
+
+void SaveLinkerCache(std::string_view data);
+
+// Connection for ReportTimings, made before specialization as the SELinux domains of apps and
+// system_server cannot connect to zygiskd. The action is sent right away, so that zygiskd
+// waits for the report on its own thread. Returns -1 on failure.
+int ConnectTimingReport();
+
+// Packed timing samples and module costs of one specialization, aggregated by zygiskd
+void ReportTimings(int fd, bool is_system_server, uid_t uid, std::string_view samples,
+                   std::string_view modules);
+
+// Summary of all reported timings, formatted for humans
+std::string GetTimingStats();
+
+// No module is loaded into processes of these uids until the list is replaced
+void SetScopedOutUids(const std::vector<uint32_t> &uids);
+
+// Microseconds from fork to the end of the last post specialize reported for uid, 0 if none
+uint32_t TakeSpecializeLatency(uid_t uid);
 }  // namespace zygiskd
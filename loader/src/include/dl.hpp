@@ -2,6 +2,39 @@
 
 #include <dlfcn.h>
 
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct MappedRegion {
+    uintptr_t start;
+    uintptr_t end;
+    int perms;
+};
+
+struct GotSlot {
+    uintptr_t addr;
+    // Protection of the page holding the slot once the linker is done with it
+    int perms;
+};
+
 void *DlopenExt(const char *path, int flags);
 
 void *DlopenMem(int memfd, int flags);
+
+// Load the library into [reserved_addr, reserved_addr + reserved_size), either writing its
+// relocated RELRO section to relro_fd or mapping the identical pages of relro_fd in place
+void *DlopenMem(int memfd, int flags, void *reserved_addr, size_t reserved_size, int relro_fd,
+                bool write_relro);
+
+// Size of the address range all loadable segments of the ELF file span, 0 on error
+size_t GetLoadSize(int fd);
+
+// Append the file backed regions the linker mapped for the library containing addr, with the
+// protections they have after relocation. The RELRO region is left out if skip_relro.
+void GetLibraryRegions(const void *addr, bool skip_relro, std::vector<MappedRegion> &regions);
+
+// Append the relocated slots of the library mapped at base that refer to symbol and currently
+// hold value, looking at both its PLT and its dynamic relocations
+void FindGotSlots(uintptr_t base, std::string_view symbol, uintptr_t value,
+                  std::vector<GotSlot> &slots);
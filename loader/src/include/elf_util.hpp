@@ -24,9 +24,11 @@
 #include <linux/elf.h>
 #include <sys/types.h>
 
+#include <span>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #define SHT_GNU_HASH 0x6ffffff6
 
@@ -35,6 +37,31 @@ class ElfImg {
 public:
     ElfImg(std::string_view elf);
 
+    // An image already mapped at base, possibly in another process, parsed from its file
+    ElfImg(std::string_view path, void *base);
+
+    // A symbol to look up by exact name or by prefix, hashes of literal names fold at compile time
+    struct SymbolQuery {
+        constexpr SymbolQuery(std::string_view name, bool prefix = false)
+            : name(name),
+              prefix(prefix),
+              gnu_hash(prefix ? 0 : GnuHash(name)),
+              elf_hash(prefix ? 0 : ElfHash(name)) {}
+
+        std::string_view name;
+        bool prefix;
+        uint32_t gnu_hash;
+        uint32_t elf_hash;
+
+        // Full name of the symbol found
+        std::string_view symbol;
+        ElfW(Addr) address = 0;
+    };
+
+    // Exact names are tried through the hash tables first, all the others are then
+    // resolved together in a single pass over .symtab
+    void resolve(std::span<SymbolQuery> queries) const;
+
     constexpr ElfW(Addr) getSymbOffset(std::string_view name) const {
         return getSymbOffset(name, GnuHash(name), ElfHash(name));
     }
@@ -74,12 +101,16 @@ private:
 
     std::string_view LinearLookupByPrefix(std::string_view name) const;
 
+    void BuildSymtabIndex() const;
+
     constexpr static uint32_t ElfHash(std::string_view name);
 
     constexpr static uint32_t GnuHash(std::string_view name);
 
     bool findModuleBase();
 
+    void parse();
+
     std::string elf;
     void *base = nullptr;
     char *buffer = nullptr;
@@ -112,7 +143,8 @@ private:
     uint32_t *gnu_bucket_;
     uint32_t *gnu_chain_;
 
-    mutable std::unordered_map<std::string_view, ElfW(Sym) *> symtabs_;
+    // .symtab functions and objects sorted by name, built on the first linear lookup
+    mutable std::vector<std::pair<std::string_view, ElfW(Sym) *>> symtabs_;
 };
 
 constexpr uint32_t ElfImg::ElfHash(std::string_view name) {
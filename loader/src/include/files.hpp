@@ -3,12 +3,19 @@
 #include <dirent.h>
 
 #include <functional>
+#include <span>
 #include <string>
+#include <vector>
 
 void file_readline(bool trim, FILE *fp, const std::function<bool(std::string_view)> &fn);
 void file_readline(bool trim, const char *file, const std::function<bool(std::string_view)> &fn);
 void file_readline(const char *file, const std::function<bool(std::string_view)> &fn);
 
+// Calls fn with each fd currently open in this process, in no particular order
+void for_each_open_fd(const std::function<void(int)> &fn);
+// Close every fd not in the sorted list keep, with close_range over the gaps if supported
+void close_fds_except(std::span<const int> keep);
+
 using sFILE = std::unique_ptr<FILE, decltype(&fclose)>;
 using sDIR = std::unique_ptr<DIR, decltype(&closedir)>;
 sDIR make_dir(DIR *dp);
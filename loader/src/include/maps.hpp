@@ -0,0 +1,64 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct MapEntry {
+    uintptr_t start;
+    uintptr_t end;
+    uint8_t perms;
+    bool is_private;
+    uintptr_t offset;
+    dev_t dev;
+    ino_t inode;
+    // Points into the buffer of the reader, only valid until the next entry is read
+    std::string_view path;
+};
+
+// Streams /proc/<pid>/maps through a single fixed buffer, without allocating per entry
+class MapsReader {
+public:
+    explicit MapsReader(pid_t pid = 0);
+    // Any file in the format of /proc/<pid>/maps
+    explicit MapsReader(const char *path);
+    ~MapsReader();
+
+    MapsReader(const MapsReader &) = delete;
+    MapsReader &operator=(const MapsReader &) = delete;
+
+    bool Next(MapEntry &entry);
+
+private:
+    bool NextLine(std::string_view &line);
+
+    int fd_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+    // Enough for any path up to PATH_MAX
+    char buf_[8192];
+};
+
+// Collect the entries matching filter into a vector of any MapInfo like aggregate,
+// such as lsplt::MapInfo, only materializing paths of the entries kept
+template <typename Info, typename Filter>
+std::vector<Info> ScanMaps(pid_t pid, Filter &&filter) {
+    std::vector<Info> infos;
+    MapsReader reader(pid);
+    for (MapEntry entry; reader.Next(entry);) {
+        if (!filter(entry)) continue;
+        infos.emplace_back(Info{entry.start, entry.end, entry.perms, entry.is_private, entry.offset,
+                                entry.dev, entry.inode, decltype(Info::path)(entry.path)});
+    }
+    return infos;
+}
+
+template <typename Info>
+std::vector<Info> ScanMaps(pid_t pid = 0) {
+    return ScanMaps<Info>(pid, [](const MapEntry &) { return true; });
+}
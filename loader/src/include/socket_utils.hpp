@@ -1,7 +1,12 @@
 #pragma once
 
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace socket_utils {
 
@@ -23,7 +28,75 @@ namespace socket_utils {
 
     int recv_fd(int fd);
 
+    // Receive count fds sent with as few SCM_RIGHTS messages as possible, empty on error
+    std::vector<int> recv_fds(int fd, size_t count);
+
     bool write_usize(int fd, size_t val);
 
     bool write_string(int fd, std::string_view str);
+
+    // Builds a request on the stack and sends it with a single writev.
+    // Strings are referenced, not copied, and must outlive flush().
+    class FrameWriter {
+    public:
+        explicit FrameWriter(int fd) : fd_(fd) {}
+
+        FrameWriter &u8(uint8_t val) { return put(&val, sizeof(val)); }
+
+        FrameWriter &u32(uint32_t val) { return put(&val, sizeof(val)); }
+
+        FrameWriter &usize(size_t val) { return put(&val, sizeof(val)); }
+
+        // Length prefixed like write_string
+        FrameWriter &string(std::string_view str);
+
+        bool flush();
+
+    private:
+        static constexpr size_t kCapacity = 128;
+        static constexpr int kMaxIov = 8;
+
+        FrameWriter &put(const void *data, size_t size);
+
+        int fd_;
+        bool ok_ = true;
+        size_t used_ = 0;
+        int iovcnt_ = 0;
+        iovec iov_[kMaxIov];
+        char buf_[kCapacity];
+    };
+
+    // Reads a fixed size part of a reply with a single read and decodes it in place
+    class FrameReader {
+    public:
+        explicit FrameReader(int fd) : fd_(fd) {}
+
+        // Replaces the buffered frame with the next size bytes of the stream
+        bool fill(size_t size);
+
+        uint8_t u8() { return take<uint8_t>(); }
+
+        uint32_t u32() { return take<uint32_t>(); }
+
+        size_t usize() { return take<size_t>(); }
+
+    private:
+        static constexpr size_t kCapacity = 64;
+
+        // Fields past the end of the frame read as 0
+        template <typename T>
+        T take() {
+            T val{};
+            if (offset_ <= size_ && size_ - offset_ >= sizeof(T)) {
+                memcpy(&val, buf_ + offset_, sizeof(T));
+            }
+            offset_ += sizeof(T);
+            return val;
+        }
+
+        int fd_;
+        size_t size_ = 0;
+        size_t offset_ = 0;
+        char buf_[kCapacity];
+    };
 }
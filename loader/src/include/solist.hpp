@@ -1,5 +1,6 @@
 #pragma once
 
+#include <span>
 #include <string>
 
 #include "elf_util.hpp"
@@ -55,15 +56,9 @@ public:
         if (dtor != nullptr) (this->*dtor)();
     }
 
-    static bool setup(const SandHook::ElfImg &linker) {
-        ctor = MemFunc{.data = {.p = reinterpret_cast<void *>(
-                                    linker.getSymbAddress("__dl__ZN18ProtectedDataGuardC2Ev")),
-                                .adj = 0}}
-                   .f;
-        dtor = MemFunc{.data = {.p = reinterpret_cast<void *>(
-                                    linker.getSymbAddress("__dl__ZN18ProtectedDataGuardD2Ev")),
-                                .adj = 0}}
-                   .f;
+    static bool setup(ElfW(Addr) ctor_addr, ElfW(Addr) dtor_addr) {
+        ctor = MemFunc{.data = {.p = reinterpret_cast<void *>(ctor_addr), .adj = 0}}.f;
+        dtor = MemFunc{.data = {.p = reinterpret_cast<void *>(dtor_addr), .adj = 0}}.f;
         return ctor != nullptr && dtor != nullptr;
     }
 
@@ -99,15 +94,10 @@ const size_t size_maximal = 0x100000;
 const size_t size_minimal = 0x100;
 const size_t llvm_suffix_length = 25;
 
-template <typename T>
-inline T *getStaticPointer(const SandHook::ElfImg &linker, const char *name) {
-    auto *addr = reinterpret_cast<T **>(linker.getSymbAddress(name));
-
-    return addr == nullptr ? nullptr : *addr;
-}
-
 bool initialize();
-bool dropSoPath(const char *target_path);
+// Drops the records of all libraries whose path contains one of patterns in a single walk of
+// solist, after taking load and unload off the linker's module counters
+bool dropSoPaths(std::span<const char *const> patterns, size_t load = 0, size_t unload = 0);
 void resetCounters(size_t load, size_t unload);
 
 }  // namespace SoList
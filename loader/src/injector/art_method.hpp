@@ -18,6 +18,10 @@ public:
         return *reinterpret_cast<void **>(reinterpret_cast<uintptr_t>(this) + data_offset);
     }
 
+    void SetData(void *data) {
+        *reinterpret_cast<void **>(reinterpret_cast<uintptr_t>(this) + data_offset) = data;
+    }
+
     static art::ArtMethod *FromReflectedMethod(JNIEnv *env, jobject method) {
         if (art_method_field) [[likely]] {
             return reinterpret_cast<art::ArtMethod *>(
@@ -1,108 +1,287 @@
+#include <link.h>
 #include <linux/mman.h>
 #include <sys/mman.h>
 
-#include <lsplt.hpp>
+#include <algorithm>
+#include <optional>
 #include <vector>
 
+#include "daemon.hpp"
 #include "logging.hpp"
+#include "misc.hpp"
 #include "solist.hpp"
 #include "zygisk.hpp"
 
-void clean_trace(const char *path, size_t load, size_t unload, bool spoof_maps) {
+void clean_trace(const char *path, size_t load, size_t unload,
+                 const std::vector<MappedRegion> &regions) {
     LOGD("cleaning trace for path %s", path);
 
-    if (load > 0 || unload > 0) SoList::resetCounters(load, unload);
-    bool path_found = SoList::dropSoPath(path);
-    if (!path_found || !spoof_maps) return;
+    bool path_found = SoList::dropSoPaths({&path, 1}, load, unload);
+    if (!path_found || regions.empty()) return;
 
-    LOGD("spoofing virtual maps for %s", path);
+    LOGD("spoofing %zu virtual map regions for %s", regions.size(), path);
     // spoofing map names is futile in Android, we do it simply
     // to avoid Zygisk detections based on string comparison
-    for (auto &map : lsplt::MapInfo::Scan()) {
-        if (strstr(map.path.c_str(), path)) {
-            void *addr = (void *) map.start;
-            size_t size = map.end - map.start;
-            void *copy = mmap(nullptr, size, PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-            if (copy == MAP_FAILED) {
-                LOGE("failed to backup block %s [%p, %p]", map.path.c_str(), addr,
-                     (void *) map.end);
-                continue;
-            }
+    size_t total = 0;
+    for (auto &region : regions) {
+        if (region.perms != PROT_NONE) total += region.end - region.start;
+    }
+    auto *copy = static_cast<uint8_t *>(MAP_FAILED);
+    if (total > 0) {
+        copy = static_cast<uint8_t *>(
+            mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0));
+        if (copy == MAP_FAILED) {
+            PLOGE("failed to backup %zu bytes for %s", total, path);
+            return;
+        }
+    }
 
-            if ((map.perms & PROT_READ) == 0) {
-                mprotect(addr, size, PROT_READ);
-            }
-            memcpy(copy, addr, size);
-            mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, addr);
-            mprotect(addr, size, map.perms);
+    // Back up all regions with a single mapping, then move its parts in place
+    size_t offset = 0;
+    for (auto &region : regions) {
+        if (region.perms == PROT_NONE) continue;
+        void *addr = (void *) region.start;
+        size_t size = region.end - region.start;
+        if ((region.perms & PROT_READ) == 0) {
+            mprotect(addr, size, PROT_READ);
+        }
+        memcpy(copy + offset, addr, size);
+        offset += size;
+    }
+    offset = 0;
+    for (auto &region : regions) {
+        void *addr = (void *) region.start;
+        size_t size = region.end - region.start;
+        if (region.perms == PROT_NONE) {
+            mmap(addr, size, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+            continue;
         }
+        mremap(copy + offset, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, addr);
+        mprotect(addr, size, region.perms);
+        offset += size;
     }
 }
 
 namespace SoList {
 
-bool initialize() {
-    SandHook::ElfImg linker("/linker");
-    if (!ProtectedDataGuard::setup(linker)) return false;
-    LOGD("found symbol ProtectedDataGuard");
+// Everything initialize() resolves, as offsets from the load address of the linker
+struct LinkerOffsets {
+    uint64_t guard_ctor;
+    uint64_t guard_dtor;
+    uint64_t solist;
+    uint64_t soinfo_free;
+    uint64_t somain;
+    uint64_t sonext;
+    uint64_t get_realpath;
+    uint64_t load_counter;
+    uint64_t unload_counter;
+    uint64_t field_size;
+    uint64_t field_next;
+    uint64_t field_realpath;
+};
 
-    std::string_view solist_sym_name = linker.findSymbolNameByPrefix("__dl__ZL6solist");
-    if (solist_sym_name.empty()) return false;
-    LOGD("found symbol name %s", solist_sym_name.data());
+// Persisted by zygiskd, only valid for the linker binary with the same build-id
+struct LinkerCache {
+    static constexpr uint32_t kMagic = 0x4c4e4b43;
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kMaxBuildIdSize = 32;
 
-    std::string_view soinfo_free_name =
-        linker.findSymbolNameByPrefix("__dl__ZL11soinfo_freeP6soinfo");
-    if (soinfo_free_name.empty()) return false;
-    LOGD("found symbol name %s", soinfo_free_name.data());
+    uint32_t magic;
+    uint32_t version;
+    uint32_t build_id_size;
+    uint8_t build_id[kMaxBuildIdSize];
+    LinkerOffsets offsets;
+};
 
-    char llvm_sufix[llvm_suffix_length + 1];
+struct LinkerImage {
+    uintptr_t base = 0;
+    std::string_view build_id;
+};
 
-    if (solist_sym_name.length() != strlen("__dl__ZL6solist")) {
-        strncpy(llvm_sufix, solist_sym_name.data() + strlen("__dl__ZL6solist"), sizeof(llvm_sufix));
-    } else {
-        llvm_sufix[0] = '\0';
-    }
-
-    char somain_sym_name[sizeof("__dl__ZL6somain") + sizeof(llvm_sufix)];
-    snprintf(somain_sym_name, sizeof(somain_sym_name), "__dl__ZL6somain%s", llvm_sufix);
+// Read the GNU build-id note of the loaded linker, without opening its file
+static LinkerImage find_linker() {
+    LinkerImage image;
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t, void *data) -> int {
+            if (info->dlpi_name == nullptr || !strstr(info->dlpi_name, "/linker")) return 0;
+            auto *image = reinterpret_cast<LinkerImage *>(data);
+            image->base = info->dlpi_addr;
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+                const auto &phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_NOTE) continue;
+                auto note = info->dlpi_addr + phdr.p_vaddr;
+                auto end = note + phdr.p_memsz;
+                while (note + sizeof(ElfW(Nhdr)) <= end) {
+                    auto *nhdr = reinterpret_cast<const ElfW(Nhdr) *>(note);
+                    auto name = note + sizeof(ElfW(Nhdr));
+                    auto desc = name + align_to(nhdr->n_namesz, 4);
+                    if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                        memcmp(reinterpret_cast<const char *>(name), "GNU", 4) == 0 &&
+                        desc + nhdr->n_descsz <= end) {
+                        image->build_id = {reinterpret_cast<const char *>(desc), nhdr->n_descsz};
+                        return 1;
+                    }
+                    note = desc + align_to(nhdr->n_descsz, 4);
+                }
+            }
+            return 1;
+        },
+        &image);
+    return image;
+}
 
-    char sonext_sym_name[sizeof("__dl__ZL6sonext") + sizeof(llvm_sufix)];
-    snprintf(sonext_sym_name, sizeof(somain_sym_name), "__dl__ZL6sonext%s", llvm_sufix);
+static bool apply_offsets(const LinkerOffsets &offsets, uintptr_t base) {
+    auto address = [base](uint64_t offset) -> ElfW(Addr) {
+        return offset == 0 ? 0 : static_cast<ElfW(Addr)>(base + offset);
+    };
+    auto static_pointer = [](ElfW(Addr) addr) -> SoInfo * {
+        return addr == 0 ? nullptr : *reinterpret_cast<SoInfo **>(addr);
+    };
 
-    char vdso_sym_name[sizeof("__dl__ZL4vdso") + sizeof(llvm_sufix)];
-    snprintf(vdso_sym_name, sizeof(vdso_sym_name), "__dl__ZL4vdso%s", llvm_sufix);
+    if (!ProtectedDataGuard::setup(address(offsets.guard_ctor), address(offsets.guard_dtor))) {
+        return false;
+    }
+    LOGD("found symbol ProtectedDataGuard");
 
-    somain = getStaticPointer<SoInfo>(linker, somain_sym_name);
+    somain = static_pointer(address(offsets.somain));
     if (somain == nullptr) return false;
     LOGD("found symbol somain");
 
-    sonext = linker.getSymbAddress<SoInfo **>(sonext_sym_name);
+    sonext = reinterpret_cast<SoInfo **>(address(offsets.sonext));
     if (sonext == nullptr) return false;
     LOGD("found symbol sonext");
 
-    auto *vdso = getStaticPointer<SoInfo>(linker, vdso_sym_name);
-    if (vdso != nullptr) LOGD("found symbol vdso");
-
-    SoInfo::get_realpath_sym = reinterpret_cast<decltype(SoInfo::get_realpath_sym)>(
-        linker.getSymbAddress("__dl__ZNK6soinfo12get_realpathEv"));
+    SoInfo::get_realpath_sym =
+        reinterpret_cast<decltype(SoInfo::get_realpath_sym)>(address(offsets.get_realpath));
     if (SoInfo::get_realpath_sym != nullptr) LOGD("found symbol get_realpath_sym");
 
     SoInfo::soinfo_free =
-        reinterpret_cast<decltype(SoInfo::soinfo_free)>(linker.getSymbAddress(soinfo_free_name));
+        reinterpret_cast<decltype(SoInfo::soinfo_free)>(address(offsets.soinfo_free));
     if (SoInfo::soinfo_free == nullptr) return false;
     LOGD("found symbol soinfo_free");
 
-    g_module_load_counter = reinterpret_cast<decltype(g_module_load_counter)>(
-        linker.getSymbAddress("__dl__ZL21g_module_load_counter"));
+    g_module_load_counter =
+        reinterpret_cast<decltype(g_module_load_counter)>(address(offsets.load_counter));
     if (g_module_load_counter != nullptr) LOGD("found symbol g_module_load_counter");
 
-    g_module_unload_counter = reinterpret_cast<decltype(g_module_unload_counter)>(
-        linker.getSymbAddress("__dl__ZL23g_module_unload_counter"));
+    g_module_unload_counter =
+        reinterpret_cast<decltype(g_module_unload_counter)>(address(offsets.unload_counter));
     if (g_module_unload_counter != nullptr) LOGD("found symbol g_module_unload_counter");
 
-    solist = getStaticPointer<SoInfo>(linker, solist_sym_name.data());
+    solist = static_pointer(address(offsets.solist));
     if (solist == nullptr) return false;
     LOGD("found symbol solist");
+    return true;
+}
+
+static bool load_cached_offsets(const LinkerImage &image) {
+    if (image.build_id.empty() || image.build_id.size() > LinkerCache::kMaxBuildIdSize) {
+        return false;
+    }
+    std::string data = zygiskd::GetLinkerCache();
+    if (data.size() != sizeof(LinkerCache)) return false;
+    LinkerCache cache;
+    memcpy(&cache, data.data(), sizeof(cache));
+    if (cache.magic != LinkerCache::kMagic || cache.version != LinkerCache::kVersion ||
+        cache.build_id_size != image.build_id.size() ||
+        memcmp(cache.build_id, image.build_id.data(), image.build_id.size()) != 0) {
+        LOGD("linker cache is stale");
+        return false;
+    }
+    if (!apply_offsets(cache.offsets, image.base)) return false;
+    SoInfo::field_size_offset = cache.offsets.field_size;
+    SoInfo::field_next_offset = cache.offsets.field_next;
+    SoInfo::field_realpath_offset = cache.offsets.field_realpath;
+    LOGD("loaded linker offsets from cache");
+    return true;
+}
+
+static void save_offsets(const LinkerImage &image, const LinkerOffsets &offsets) {
+    if (image.build_id.empty() || image.build_id.size() > LinkerCache::kMaxBuildIdSize) return;
+    LinkerCache cache{};
+    cache.magic = LinkerCache::kMagic;
+    cache.version = LinkerCache::kVersion;
+    cache.build_id_size = image.build_id.size();
+    memcpy(cache.build_id, image.build_id.data(), image.build_id.size());
+    cache.offsets = offsets;
+    zygiskd::SaveLinkerCache({reinterpret_cast<const char *>(&cache), sizeof(cache)});
+}
+
+bool initialize() {
+    LinkerImage image = find_linker();
+    if (load_cached_offsets(image)) return true;
+
+    SandHook::ElfImg linker("/linker");
+    if (!linker.isValid()) return false;
+
+    // Static symbols may carry the same LLVM suffix, which is only known once one is found
+    enum {
+        GUARD_CTOR,
+        GUARD_DTOR,
+        SOLIST,
+        SOINFO_FREE,
+        SOMAIN,
+        SONEXT,
+        VDSO,
+        GET_REALPATH,
+        LOAD_COUNTER,
+        UNLOAD_COUNTER,
+    };
+    SandHook::ElfImg::SymbolQuery symbols[] = {
+        {"__dl__ZN18ProtectedDataGuardC2Ev"},
+        {"__dl__ZN18ProtectedDataGuardD2Ev"},
+        {"__dl__ZL6solist", true},
+        {"__dl__ZL11soinfo_freeP6soinfo", true},
+        {"__dl__ZL6somain", true},
+        {"__dl__ZL6sonext", true},
+        {"__dl__ZL4vdso", true},
+        {"__dl__ZNK6soinfo12get_realpathEv"},
+        {"__dl__ZL21g_module_load_counter"},
+        {"__dl__ZL23g_module_unload_counter"},
+    };
+    linker.resolve(symbols);
+
+    std::string_view solist_sym_name = symbols[SOLIST].symbol;
+    if (solist_sym_name.empty()) return false;
+    LOGD("found symbol name %s", solist_sym_name.data());
+
+    std::string_view soinfo_free_name = symbols[SOINFO_FREE].symbol;
+    if (soinfo_free_name.empty()) return false;
+    LOGD("found symbol name %s", soinfo_free_name.data());
+
+    std::string_view llvm_suffix = solist_sym_name.substr(strlen("__dl__ZL6solist"));
+    if (llvm_suffix.size() > llvm_suffix_length) {
+        llvm_suffix = llvm_suffix.substr(0, llvm_suffix_length);
+    }
+
+    // Prefixes may have matched another variant, look those up with the exact suffix
+    auto with_suffix = [&](const SandHook::ElfImg::SymbolQuery &query) -> ElfW(Addr) {
+        if (query.symbol.size() == query.name.size() + llvm_suffix.size() &&
+            query.symbol.ends_with(llvm_suffix)) {
+            return query.address;
+        }
+        std::string name(query.name);
+        name += llvm_suffix;
+        return linker.getSymbAddress(name);
+    };
+    auto offset = [&](ElfW(Addr) addr) -> uint64_t { return addr == 0 ? 0 : addr - image.base; };
+
+    LinkerOffsets offsets{
+        .guard_ctor = offset(symbols[GUARD_CTOR].address),
+        .guard_dtor = offset(symbols[GUARD_DTOR].address),
+        .solist = offset(symbols[SOLIST].address),
+        .soinfo_free = offset(symbols[SOINFO_FREE].address),
+        .somain = offset(with_suffix(symbols[SOMAIN])),
+        .sonext = offset(with_suffix(symbols[SONEXT])),
+        .get_realpath = offset(symbols[GET_REALPATH].address),
+        .load_counter = offset(symbols[LOAD_COUNTER].address),
+        .unload_counter = offset(symbols[UNLOAD_COUNTER].address),
+    };
+    if (!apply_offsets(offsets, image.base)) return false;
+
+    auto vdso_var = with_suffix(symbols[VDSO]);
+    auto *vdso = vdso_var == 0 ? nullptr : *reinterpret_cast<SoInfo **>(vdso_var);
+    if (vdso != nullptr) LOGD("found symbol vdso");
 
     bool size_filed_found = false;
     bool next_filed_found = false;
@@ -144,24 +323,45 @@ bool initialize() {
         }
     }
 
+    // Walking solist with guessed offsets would corrupt the linker, and a failed probe must
+    // not be cached for later boots either
+    if (!size_filed_found || !next_filed_found) {
+        LOGE("failed to find soinfo fields, size %d next %d", size_filed_found, next_filed_found);
+        solist = nullptr;
+        return false;
+    }
+
+    offsets.field_size = SoInfo::field_size_offset;
+    offsets.field_next = SoInfo::field_next_offset;
+    offsets.field_realpath = SoInfo::field_realpath_offset;
+    save_offsets(image, offsets);
     return true;
 }
 
-bool dropSoPath(const char *target_path) {
+bool dropSoPaths(std::span<const char *const> patterns, size_t load, size_t unload) {
     bool path_found = false;
     if (solist == nullptr && !initialize()) {
         LOGE("failed to initialize solist");
         return path_found;
     }
-    for (auto *iter = solist; iter; iter = iter->getNext()) {
-        if (iter->getPath() && strstr(iter->getPath(), target_path)) {
-            SoList::ProtectedDataGuard guard;
-            LOGD("dropping solist record for %s with size %zu", iter->getPath(), iter->getSize());
-            if (iter->getSize() > 0) {
-                iter->setSize(0);
-                SoInfo::soinfo_free(iter);
-                path_found = true;
-            }
+    if (load > 0 || unload > 0) resetCounters(load, unload);
+    // The guard is reference counted by the linker, one for the whole walk unprotects its data
+    // once however many records are dropped, and none is taken if nothing matches
+    std::optional<ProtectedDataGuard> guard;
+    for (SoInfo *iter = solist, *next; iter; iter = next) {
+        // soinfo_free unlinks and clears the record, so the next one is read beforehand
+        next = iter->getNext();
+        const char *path = iter->getPath();
+        if (path == nullptr) continue;
+        bool matched = std::any_of(patterns.begin(), patterns.end(),
+                                   [&](const char *pattern) { return strstr(path, pattern); });
+        if (!matched) continue;
+        LOGD("dropping solist record for %s with size %zu", path, iter->getSize());
+        if (iter->getSize() > 0) {
+            if (!guard) guard.emplace();
+            iter->setSize(0);
+            SoInfo::soinfo_free(iter);
+            path_found = true;
         }
     }
     return path_found;
@@ -1,13 +1,57 @@
+#include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+
+#include <algorithm>
+
 #include "daemon.hpp"
 #include "logging.hpp"
 #include "zygisk.hpp"
 
 using namespace std;
 
+struct SelfRange {
+    uintptr_t symbol;
+    uintptr_t start;
+    uintptr_t end;
+};
+
+// The range of file backed segments of this library, as the injector would find it in maps
+static void find_self(void *&addr, size_t &size) {
+    SelfRange range{reinterpret_cast<uintptr_t>(&find_self), 0, 0};
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t, void *data) -> int {
+            auto *range = reinterpret_cast<SelfRange *>(data);
+            uintptr_t page_size = getpagesize();
+            uintptr_t start = UINTPTR_MAX, end = 0;
+            bool contains = false;
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+                const auto &phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_LOAD) continue;
+                uintptr_t seg_start = info->dlpi_addr + phdr.p_vaddr;
+                if (range->symbol >= seg_start && range->symbol < seg_start + phdr.p_memsz) {
+                    contains = true;
+                }
+                start = std::min(start, seg_start & ~(page_size - 1));
+                end = std::max(end, (seg_start + phdr.p_filesz + page_size - 1) & ~(page_size - 1));
+            }
+            if (!contains) return 0;
+            range->start = start;
+            range->end = end;
+            return 1;
+        },
+        &range);
+    addr = reinterpret_cast<void *>(range.start);
+    size = range.end - range.start;
+}
+
 extern "C" [[gnu::visibility("default")]]
 void entry(void *addr, size_t size, const char *path) {
     LOGI("Zygisk library injected, version %s", ZKSU_VERSION);
 
+    // Injected without scanning the maps of zygote in between
+    if (addr == nullptr) find_self(addr, size);
+
     zygiskd::Init(path);
 
     if (!zygiskd::PingHeartbeat()) {
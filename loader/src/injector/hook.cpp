@@ -1,7 +1,6 @@
 #include <dlfcn.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
-#include <sys/resource.h>
 #include <unistd.h>
 #include <unwind.h>
 
@@ -10,7 +9,9 @@
 #include "art_method.hpp"
 #include "daemon.hpp"
 #include "jni_helper.hpp"
+#include "maps.hpp"
 #include "module.hpp"
+#include "timing.hpp"
 #include "zygisk.hpp"
 
 using namespace std;
@@ -92,7 +93,7 @@ HookContext *g_hook;
 DCL_HOOK_FUNC(static char *, strdup, const char *str) {
     if (strcmp(kZygoteInit, str) == 0) {
         g_hook->hook_zygote_jni();
-        g_hook->cached_map_infos = lsplt::MapInfo::Scan();
+        g_hook->cached_map_infos = ScanMaps<lsplt::MapInfo>();
     }
     return old_strdup(str);
 }
@@ -107,9 +108,9 @@ DCL_HOOK_FUNC(static int, unshare, int flags) {
         // Skip system server and the first app process since we don't need to hide traces for them
         !(g_ctx->flags & SERVER_FORK_AND_SPECIALIZE) && !(g_ctx->info_flags & IS_FIRST_PROCESS)) {
         if (g_ctx->info_flags & (PROCESS_IS_MANAGER | PROCESS_GRANTED_ROOT)) {
-            ZygiskContext::update_mount_namespace(zygiskd::MountNamespace::Root);
+            g_ctx->update_mount_namespace(zygiskd::MountNamespace::Root);
         } else if (!(g_ctx->flags & DO_REVERT_UNMOUNT)) {
-            ZygiskContext::update_mount_namespace(zygiskd::MountNamespace::Module);
+            g_ctx->update_mount_namespace(zygiskd::MountNamespace::Module);
         }
         old_unshare(CLONE_NEWNS);
     }
@@ -151,12 +152,6 @@ DCL_HOOK_FUNC(static int, pthread_attr_setstacksize, void *target, size_t size)
 #undef DCL_HOOK_FUNC
 
 // -----------------------------------------------------------------
-static size_t get_fd_max() {
-    rlimit r{32768, 32768};
-    getrlimit(RLIMIT_NOFILE, &r);
-    return r.rlim_max;
-}
-
 ZygiskContext::ZygiskContext(JNIEnv *env, void *args)
     : env(env),
       args{args},
@@ -164,9 +159,10 @@ ZygiskContext::ZygiskContext(JNIEnv *env, void *args)
       pid(-1),
       flags(0),
       info_flags(0),
-      allowed_fds(get_fd_max()),
       hook_info_lock(PTHREAD_MUTEX_INITIALIZER) {
     g_ctx = this;
+    arena::Reset();
+    timing::Reset();
 }
 
 ZygiskContext::~ZygiskContext() {
@@ -217,7 +213,26 @@ void HookContext::register_hook(dev_t dev, ino_t inode, const char *symbol, void
         LOGE("Failed to register plt_hook \"%s\"\n", symbol);
         return;
     }
-    plt_backup.emplace_back(dev, inode, symbol, old_func);
+    plt_backup.emplace_back(dev, inode, symbol, new_func, old_func);
+}
+
+// Find the slots lsplt patched for plt_backup[first..], so that unloading does not depend
+// on the map cache. Without all of them, restoring falls back to lsplt.
+void HookContext::record_plt_slots(size_t first) {
+    for (size_t i = first; i < plt_backup.size(); i++) {
+        auto &[dev, inode, sym, new_func, old_func] = plt_backup[i];
+        auto map = std::find_if(cached_map_infos.begin(), cached_map_infos.end(), [&](auto &m) {
+            return m.dev == dev && m.inode == inode && m.offset == 0;
+        });
+        if (map == cached_map_infos.end()) {
+            plt_slots_recorded = false;
+            continue;
+        }
+        std::vector<GotSlot> slots;
+        FindGotSlots(map->start, sym, reinterpret_cast<uintptr_t>(new_func), slots);
+        if (slots.empty()) plt_slots_recorded = false;
+        for (auto &slot : slots) plt_slots.emplace_back(slot, *old_func);
+    }
 }
 
 #define PLT_HOOK_REGISTER_SYM(DEV, INODE, SYM, NAME)                                               \
@@ -230,7 +245,7 @@ void HookContext::hook_plt() {
     ino_t android_runtime_inode = 0;
     dev_t android_runtime_dev = 0;
 
-    cached_map_infos = lsplt::MapInfo::Scan();
+    cached_map_infos = ScanMaps<lsplt::MapInfo>();
     for (auto &map : cached_map_infos) {
         if (map.path.ends_with("/libandroid_runtime.so")) {
             android_runtime_inode = map.inode;
@@ -246,8 +261,9 @@ void HookContext::hook_plt() {
 
     // Remove unhooked methods
     plt_backup.erase(std::remove_if(plt_backup.begin(), plt_backup.end(),
-                                    [](auto &t) { return *std::get<3>(t) == nullptr; }),
+                                    [](auto &t) { return *std::get<4>(t) == nullptr; }),
                      plt_backup.end());
+    record_plt_slots(0);
 }
 
 void HookContext::hook_unloader() {
@@ -262,13 +278,40 @@ void HookContext::hook_unloader() {
         }
     }
 
+    size_t first = plt_backup.size();
     PLT_HOOK_REGISTER(art_dev, art_inode, pthread_attr_setstacksize);
     if (!lsplt::CommitHook(cached_map_infos)) LOGE("plt_hook failed\n");
+    record_plt_slots(first);
+}
+
+// Write back the original values page by page
+bool HookContext::restore_plt_slots() {
+    std::sort(plt_slots.begin(), plt_slots.end(),
+              [](auto &a, auto &b) { return a.first.addr < b.first.addr; });
+    uintptr_t page_size = getpagesize();
+    for (size_t i = 0; i < plt_slots.size();) {
+        uintptr_t page = plt_slots[i].first.addr & ~(page_size - 1);
+        int perms = plt_slots[i].first.perms;
+        if (mprotect(reinterpret_cast<void *>(page), page_size, PROT_READ | PROT_WRITE) != 0) {
+            PLOGE("mprotect %p", reinterpret_cast<void *>(page));
+            return false;
+        }
+        for (; i < plt_slots.size() && (plt_slots[i].first.addr & ~(page_size - 1)) == page; i++) {
+            *reinterpret_cast<void **>(plt_slots[i].first.addr) = plt_slots[i].second;
+        }
+        mprotect(reinterpret_cast<void *>(page), page_size, perms);
+    }
+    return true;
 }
 
 void HookContext::restore_plt_hook() {
+    if (plt_slots_recorded) {
+        if (!restore_plt_slots()) should_unmap = false;
+        return;
+    }
+
     // Unhook plt_hook
-    for (const auto &[dev, inode, sym, old_func] : plt_backup) {
+    for (const auto &[dev, inode, sym, new_func, old_func] : plt_backup) {
         if (!lsplt::RegisterHook(dev, inode, sym, *old_func, nullptr)) {
             LOGE("Failed to register plt_hook [%s]\n", sym);
             should_unmap = false;
@@ -282,7 +325,10 @@ void HookContext::restore_plt_hook() {
 
 // -----------------------------------------------------------------
 
-void HookContext::hook_jni_methods(JNIEnv *env, const char *clz, JNIMethods methods) {
+// The ArtMethod of each replaced method is appended to art_methods with its original data
+void HookContext::hook_jni_methods(
+    JNIEnv *env, const char *clz, JNIMethods methods,
+    std::vector<std::pair<lsplant::art::ArtMethod *, void *>> *art_methods) {
     auto clazz = env->FindClass(clz);
     if (clazz == nullptr) {
         env->ExceptionClear();
@@ -293,6 +339,7 @@ void HookContext::hook_jni_methods(JNIEnv *env, const char *clz, JNIMethods meth
     }
 
     vector<JNINativeMethod> hooks;
+    vector<std::pair<lsplant::art::ArtMethod *, JNINativeMethod *>> hooked;
     for (auto &native_method : methods) {
         // It's useful to allow nullptr function pointer for restoring hook
         if (!native_method.fnPtr) continue;
@@ -317,6 +364,7 @@ void HookContext::hook_jni_methods(JNIEnv *env, const char *clz, JNIMethods meth
         }
         auto artMethod = lsplant::art::ArtMethod::FromReflectedMethod(env, method);
         hooks.push_back(native_method);
+        hooked.emplace_back(artMethod, &native_method);
         auto original_method = artMethod->GetData();
         LOGV("replaced %s %s orig %p", clz, native_method.name, original_method);
         native_method.fnPtr = original_method;
@@ -324,6 +372,15 @@ void HookContext::hook_jni_methods(JNIEnv *env, const char *clz, JNIMethods meth
 
     if (hooks.empty()) return;
     env->RegisterNatives(clazz, hooks.data(), hooks.size());
+
+    if (art_methods == nullptr) return;
+    for (size_t i = 0; i < hooked.size(); i++) {
+        auto [art_method, native_method] = hooked[i];
+        // Only trust the cache where the registration went through as expected
+        if (art_method->GetData() == hooks[i].fnPtr) {
+            art_methods->emplace_back(art_method, native_method->fnPtr);
+        }
+    }
 }
 
 void HookContext::hook_zygote_jni() {
@@ -369,10 +426,16 @@ void HookContext::hook_zygote_jni() {
         LOGE("failed to init ArtMethod");
         return;
     }
-    hook_jni_methods(env, kZygote, zygote_methods);
+    hook_jni_methods(env, kZygote, zygote_methods, &zygote_art_methods);
 }
 
 void HookContext::restore_zygote_hook(JNIEnv *env) {
+    // Children inherit the ArtMethods of zygote at the same addresses
+    if (zygote_art_methods.size() == std::count_if(zygote_methods.begin(), zygote_methods.end(),
+                                                   [](auto &m) { return m.fnPtr != nullptr; })) {
+        for (auto &[method, original] : zygote_art_methods) method->SetData(original);
+        return;
+    }
     hook_jni_methods(env, kZygote, zygote_methods);
 }
 
@@ -381,7 +444,7 @@ void HookContext::restore_zygote_hook(JNIEnv *env) {
 void hook_entry(void *start_addr, size_t block_size) {
     g_hook = new HookContext(start_addr, block_size);
     g_hook->hook_plt();
-    clean_trace(zygiskd::GetTmpPath().data(), 1, 0, false);
+    clean_trace(zygiskd::GetTmpPath().data(), 1, 0);
 }
 
 void hookJniNativeMethods(JNIEnv *env, const char *clz, JNINativeMethod *methods, int numMethods) {
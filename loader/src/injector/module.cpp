@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/system_properties.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -15,12 +16,13 @@
 #include "files.hpp"
 #include "logging.hpp"
 #include "misc.hpp"
+#include "timing.hpp"
 #include "zygisk.hpp"
 
 using namespace std;
 
-ZygiskModule::ZygiskModule(int id, void *handle, void *entry)
-    : id(id), handle(handle), entry{entry}, api{}, mod{nullptr} {
+ZygiskModule::ZygiskModule(int id, void *handle, void *entry, uint32_t module_flags)
+    : id(id), module_flags(module_flags), handle(handle), entry{entry}, api{}, mod{nullptr} {
     // Make sure all pointers are null
     memset(&api, 0, sizeof(api));
     api.base.impl = this;
@@ -55,11 +57,19 @@ bool ZygiskModule::RegisterModuleImpl(ApiTable *api, long *module) {
         api->v2.getFlags = [](auto) { return ZygiskModule::getFlags(); };
     }
     if (api_version >= 4) {
-        api->v4.pltHookCommit = []() { return lsplt::CommitHook(g_hook->cached_map_infos); };
+        api->v4.pltHookCommit = []() {
+            if (g_ctx == nullptr) return lsplt::CommitHook(g_hook->cached_map_infos);
+            return g_ctx->defer_plt_commit() || g_ctx->commit_plt_hooks();
+        };
         api->v4.pltHookRegister = [](dev_t dev, ino_t inode, const char *symbol, void *fn,
                                      void **backup) {
             if (dev == 0 || inode == 0 || symbol == nullptr || fn == nullptr) return;
-            lsplt::RegisterHook(dev, inode, symbol, fn, backup);
+            ZygiskModule *m = g_ctx ? g_ctx->active_module : nullptr;
+            if (m) m->cost.plt_hooks_registered++;
+            if (lsplt::RegisterHook(dev, inode, symbol, fn, backup) && m) {
+                m->plt_hooks_pending++;
+                if (backup) m->plt_backups_pending = true;
+            }
         };
         api->v4.exemptFd = [](int fd) { return g_ctx && g_ctx->exempt_fd(fd); };
     }
@@ -83,7 +93,30 @@ bool ZygiskModule::valid() const {
 }
 
 /* Zygisksu changed: Use own zygiskd */
-int ZygiskModule::connectCompanion() const { return zygiskd::ConnectCompanion(id); }
+int ZygiskModule::connectCompanion() const {
+    if (!(module_flags & zygiskd::REUSE_COMPANION)) return zygiskd::ConnectCompanion(id);
+
+    struct stat st;
+    if (companion_fd < 0 || fstat(companion_fd, &st) != 0 || st.st_dev != companion_dev ||
+        st.st_ino != companion_ino) {
+        companion_fd = zygiskd::ConnectCompanion(id);
+        if (companion_fd < 0 || fstat(companion_fd, &st) != 0) return -1;
+        companion_dev = st.st_dev;
+        companion_ino = st.st_ino;
+        if (g_ctx) g_ctx->exempt_fd(companion_fd);
+    }
+    // Modules own what they are handed and may close it
+    return fcntl(companion_fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void ZygiskModule::closeCompanion() const {
+    struct stat st;
+    if (companion_fd >= 0 && fstat(companion_fd, &st) == 0 && st.st_dev == companion_dev &&
+        st.st_ino == companion_ino) {
+        close(companion_fd);
+    }
+    companion_fd = -1;
+}
 
 /* Zygisksu changed: Use own zygiskd */
 int ZygiskModule::getModuleDir() const { return zygiskd::GetModuleDir(id); }
@@ -102,7 +135,7 @@ void ZygiskModule::setOption(zygisk::Option opt) {
 
 uint32_t ZygiskModule::getFlags() { return g_ctx ? (g_ctx->info_flags & ~PRIVATE_MASK) : 0; }
 
-bool ZygiskModule::tryUnload() const { return unload && dlclose(handle) == 0; }
+bool ZygiskModule::tryUnload() const { return unload && !isResident() && dlclose(handle) == 0; }
 
 // -----------------------------------------------------------------
 
@@ -137,39 +170,129 @@ void ZygiskModule::postServerSpecialize(const ServerSpecializeArgs_v1 *args) con
 
 // -----------------------------------------------------------------
 
+// Extract the literal of basic regexes like `.*/libc\.so$`, where escaped characters
+// are literal and only `^`, `$` and a leading or trailing `.*` are allowed to be special
+bool ZygiskContext::PathRegex::compile(const char *pattern) {
+    if (regcomp(&regex, pattern, REG_NOSUB) != 0) return false;
+    kind = Literal::None;
+    literal.clear();
+
+    std::string_view p = pattern;
+    bool anchor_start = p.starts_with('^');
+    if (anchor_start) p.remove_prefix(1);
+    if (p.starts_with(".*")) {
+        anchor_start = false;
+        p.remove_prefix(2);
+    }
+    bool anchor_end = p.ends_with('$') && !p.ends_with("\\$");
+    if (anchor_end) p.remove_suffix(1);
+    if (p.ends_with(".*") && !p.ends_with("\\.*")) {
+        anchor_end = false;
+        p.remove_suffix(2);
+    }
+    if (p.empty()) return true;
+
+    std::string text;
+    for (size_t i = 0; i < p.size(); i++) {
+        char c = p[i];
+        if (c == '\\') {
+            if (++i == p.size()) return true;
+            c = p[i];
+            // Escaped letters, digits and braces are operators
+            if (strchr(".*[]^$\\/-_", c) == nullptr) return true;
+        } else if (!isalnum(static_cast<unsigned char>(c)) && strchr("/-_@,=:~%+", c) == nullptr) {
+            return true;
+        }
+        text += c;
+    }
+
+    literal = std::move(text);
+    if (anchor_start && anchor_end) {
+        kind = Literal::Exact;
+    } else if (anchor_start) {
+        kind = Literal::Prefix;
+    } else if (anchor_end) {
+        kind = Literal::Suffix;
+    } else {
+        kind = Literal::Substring;
+    }
+    return true;
+}
+
+bool ZygiskContext::PathRegex::matches(const std::string &path) const {
+    switch (kind) {
+    case Literal::Exact:
+        return path == literal;
+    case Literal::Prefix:
+        return path.starts_with(literal);
+    case Literal::Suffix:
+        return path.ends_with(literal);
+    case Literal::Substring:
+        return path.find(literal) != std::string::npos;
+    case Literal::None:
+        break;
+    }
+    return regexec(&regex, path.data(), 0, nullptr, 0) == 0;
+}
+
 void ZygiskContext::plt_hook_register(const char *regex, const char *symbol, void *fn,
                                       void **backup) {
     if (regex == nullptr || symbol == nullptr || fn == nullptr) return;
-    regex_t re;
-    if (regcomp(&re, regex, REG_NOSUB) != 0) return;
+    PathRegex re;
+    if (!re.compile(regex)) return;
     mutex_guard lock(hook_info_lock);
-    register_info.emplace_back(RegisterInfo{re, symbol, fn, backup});
+    if (active_module) active_module->cost.plt_hooks_registered++;
+    register_info.emplace_back(RegisterInfo{std::move(re), symbol, fn, backup, active_module});
 }
 
 void ZygiskContext::plt_hook_exclude(const char *regex, const char *symbol) {
     if (!regex) return;
-    regex_t re;
-    if (regcomp(&re, regex, REG_NOSUB) != 0) return;
+    PathRegex re;
+    if (!re.compile(regex)) return;
     mutex_guard lock(hook_info_lock);
-    ignore_info.emplace_back(IgnoreInfo{re, symbol ?: ""});
+    ignore_info.emplace_back(IgnoreInfo{std::move(re), symbol ?: ""});
 }
 
 void ZygiskContext::plt_hook_process_regex() {
     if (register_info.empty()) return;
+
+    // A library may be mapped several times, match each file only once
+    std::vector<const lsplt::MapInfo *> libraries;
     for (auto &map : g_hook->cached_map_infos) {
         if (map.offset != 0 || !map.is_private || !(map.perms & PROT_READ)) continue;
+        libraries.push_back(&map);
+    }
+    auto file_less = [](auto *a, auto *b) {
+        return std::tie(a->dev, a->inode) < std::tie(b->dev, b->inode);
+    };
+    auto same_file = [](auto *a, auto *b) { return a->dev == b->dev && a->inode == b->inode; };
+    std::stable_sort(libraries.begin(), libraries.end(), file_less);
+    libraries.erase(std::unique(libraries.begin(), libraries.end(), same_file), libraries.end());
+
+    std::vector<const IgnoreInfo *> ignores;
+    for (auto *map : libraries) {
+        // Ignores are only evaluated for libraries matched by some register entry
+        bool ignores_evaluated = false;
+        bool ignore_all = false;
+        ignores.clear();
         for (auto &reg : register_info) {
-            if (regexec(&reg.regex, map.path.data(), 0, nullptr, 0) != 0) continue;
-            bool ignored = false;
-            for (auto &ign : ignore_info) {
-                if (regexec(&ign.regex, map.path.data(), 0, nullptr, 0) != 0) continue;
-                if (ign.symbol.empty() || ign.symbol == reg.symbol) {
-                    ignored = true;
-                    break;
+            if (!reg.regex.matches(map->path)) continue;
+            if (!ignores_evaluated) {
+                ignores_evaluated = true;
+                for (auto &ign : ignore_info) {
+                    if (!ign.regex.matches(map->path)) continue;
+                    if (ign.symbol.empty()) ignore_all = true;
+                    ignores.push_back(&ign);
                 }
             }
-            if (!ignored) {
-                lsplt::RegisterHook(map.dev, map.inode, reg.symbol, reg.callback, reg.backup);
+            if (ignore_all || std::any_of(ignores.begin(), ignores.end(),
+                                          [&](auto *ign) { return ign->symbol == reg.symbol; })) {
+                continue;
+            }
+            if (lsplt::RegisterHook(map->dev, map->inode, reg.symbol, reg.callback, reg.backup) &&
+                reg.module) {
+                reg.module->plt_hooks_pending++;
+                if (reg.backup) reg.module->plt_backups_pending = true;
             }
         }
     }
@@ -179,10 +302,36 @@ bool ZygiskContext::plt_hook_commit() {
     {
         mutex_guard lock(hook_info_lock);
         plt_hook_process_regex();
+        for (auto &reg : register_info) regfree(&reg.regex.regex);
+        for (auto &ign : ignore_info) regfree(&ign.regex.regex);
         register_info.clear();
         ignore_info.clear();
     }
-    return lsplt::CommitHook(g_hook->cached_map_infos);
+    if (defer_plt_commit()) return true;
+    return commit_plt_hooks();
+}
+
+// Modules opting in with zygisk/defer_plt_commit get their commits coalesced into one once all
+// pre callbacks returned. Deferred commits report success before anything is applied, so hooks
+// waiting for their backup are always committed right away.
+bool ZygiskContext::defer_plt_commit() {
+    if (!(flags & DEFER_PLT_COMMIT) || active_module == nullptr ||
+        active_module->plt_backups_pending) {
+        return false;
+    }
+    flags |= PLT_COMMIT_PENDING;
+    return true;
+}
+
+// A commit applies all queued hooks, so modules only get them accounted on success
+bool ZygiskContext::commit_plt_hooks() {
+    bool success = lsplt::CommitHook(g_hook->cached_map_infos);
+    for (auto &m : modules) {
+        if (success) m.cost.plt_hooks_committed += m.plt_hooks_pending;
+        m.plt_hooks_pending = 0;
+        m.plt_backups_pending = false;
+    }
+    return success;
 }
 
 // -----------------------------------------------------------------
@@ -191,50 +340,84 @@ void ZygiskContext::sanitize_fds() {
     if (!is_child()) {
         return;
     }
+    timing::Scope scope(timing::Phase::SanitizeFds);
 
     if (can_exempt_fd() && !exempted_fds.empty()) {
-        auto update_fd_array = [&](int old_len) -> jintArray {
-            jintArray array = env->NewIntArray(static_cast<int>(old_len + exempted_fds.size()));
-            if (array == nullptr) return nullptr;
-
-            env->SetIntArrayRegion(array, old_len, static_cast<int>(exempted_fds.size()),
-                                   exempted_fds.data());
-            for (int fd : exempted_fds) {
-                if (fd >= 0 && fd < allowed_fds.size()) {
-                    allowed_fds[fd] = true;
-                }
-            }
-            *args.app->fds_to_ignore = array;
-            return array;
-        };
+        ignore_fds(exempted_fds);
+    }
 
-        if (jintArray fdsToIgnore = *args.app->fds_to_ignore) {
-            int *arr = env->GetIntArrayElements(fdsToIgnore, nullptr);
-            int len = env->GetArrayLength(fdsToIgnore);
-            for (int i = 0; i < len; ++i) {
-                int fd = arr[i];
-                if (fd >= 0 && fd < allowed_fds.size()) {
-                    allowed_fds[fd] = true;
-                }
-            }
-            if (jintArray newFdList = update_fd_array(len)) {
-                env->SetIntArrayRegion(newFdList, 0, len, arr);
-            }
-            env->ReleaseIntArrayElements(fdsToIgnore, arr, JNI_ABORT);
-        } else {
-            update_fd_array(0);
+    // Close all forbidden fds to prevent crashing
+    std::sort(allowed_fds.begin(), allowed_fds.end());
+    allowed_fds.erase(std::unique(allowed_fds.begin(), allowed_fds.end()), allowed_fds.end());
+    close_fds_except(allowed_fds);
+}
+
+// Append fds to fds_to_ignore, so that the fd checks of zygote let them pass
+void ZygiskContext::ignore_fds(std::span<const int> fds) {
+    auto update_fd_array = [&](int old_len) -> jintArray {
+        jintArray array = env->NewIntArray(static_cast<int>(old_len + fds.size()));
+        if (array == nullptr) return nullptr;
+
+        env->SetIntArrayRegion(array, old_len, static_cast<int>(fds.size()), fds.data());
+        allowed_fds.insert(allowed_fds.end(), fds.begin(), fds.end());
+        *args.app->fds_to_ignore = array;
+        return array;
+    };
+
+    if (jintArray fdsToIgnore = *args.app->fds_to_ignore) {
+        int *arr = env->GetIntArrayElements(fdsToIgnore, nullptr);
+        int len = env->GetArrayLength(fdsToIgnore);
+        allowed_fds.insert(allowed_fds.end(), arr, arr + len);
+        if (jintArray newFdList = update_fd_array(len)) {
+            env->SetIntArrayRegion(newFdList, 0, len, arr);
         }
+        env->ReleaseIntArrayElements(fdsToIgnore, arr, JNI_ABORT);
+    } else {
+        update_fd_array(0);
     }
+}
 
-    // Close all forbidden fds to prevent crashing
-    auto dir = open_dir("/proc/self/fd");
-    int dfd = dirfd(dir.get());
-    for (dirent *entry; (entry = readdir(dir.get()));) {
-        int fd = parse_int(entry->d_name);
-        if ((fd < 0 || fd >= allowed_fds.size() || !allowed_fds[fd]) && fd != dfd) {
-            close(fd);
+static void close_mount_namespaces() {
+    for (int &fd : g_hook->mount_namespace_fds) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+}
+
+static bool usap_pool_enabled() {
+    for (auto name : {"persist.device_config.runtime_native.usap_pool_enabled",
+                      "dalvik.vm.usap_pool_enabled"}) {
+        char value[PROP_VALUE_MAX] = {};
+        __system_property_get(name, value);
+        if (strcmp(value, "true") == 0) return true;
+    }
+    return false;
+}
+
+// Zygote keeps the cached mount namespaces open, so that children switch to them without
+// asking zygiskd. As zygote aborts forks with unknown fds open, they are only held while
+// every fork reports them through fds_to_ignore, which forks of the USAP pool do not.
+// The pool can be enabled between two forks without zygote noticing, so holding is opt-in:
+// zygiskd only publishes the namespaces when the hold_mount_namespaces marker exists.
+void ZygiskContext::hold_mount_namespaces() {
+    uint32_t generation = g_hook->flags_table.MountNamespaceGeneration();
+    bool can_hold = generation != 0 && can_exempt_fd() && !usap_pool_enabled();
+    if (!can_hold || generation != g_hook->mount_namespace_generation) {
+        close_mount_namespaces();
+        g_hook->mount_namespace_generation = generation;
+    }
+    if (!can_hold) return;
+
+    std::vector<int> fds;
+    for (auto type : {zygiskd::MountNamespace::Root, zygiskd::MountNamespace::Module}) {
+        int &fd = g_hook->mount_namespace_fds[(int) type];
+        if (fd < 0) {
+            auto path = g_hook->flags_table.MountNamespacePath(type);
+            if (!path.empty()) fd = open(path.data(), O_RDONLY | O_CLOEXEC);
         }
+        if (fd >= 0) fds.push_back(fd);
     }
+    if (!fds.empty()) ignore_fds(fds);
 }
 
 bool ZygiskContext::exempt_fd(int fd) {
@@ -256,6 +439,11 @@ static int sigmask(int how, int signum) {
 }
 
 void ZygiskContext::fork_pre() {
+    timing::MarkFork();
+    timing::Scope scope(timing::Phase::ForkPre);
+    // Zygote resident modules are the only 3rd party code allowed before forking
+    preload_modules();
+
     // Do our own fork before loading any 3rd party code
     // First block SIGCHLD, unblock after original fork is done
     sigmask(SIG_BLOCK, SIGCHLD);
@@ -264,17 +452,7 @@ void ZygiskContext::fork_pre() {
     if (!is_child()) return;
 
     // Record all open fds
-    auto dir = xopen_dir("/proc/self/fd");
-    for (dirent *entry; (entry = readdir(dir.get()));) {
-        int fd = parse_int(entry->d_name);
-        if (fd < 0 || fd >= allowed_fds.size()) {
-            close(fd);
-            continue;
-        }
-        allowed_fds[fd] = true;
-    }
-    // The dirfd will be closed once out of scope
-    allowed_fds[dirfd(dir.get())] = false;
+    for_each_open_fd([&](int fd) { allowed_fds.push_back(fd); });
 }
 
 void ZygiskContext::fork_post() {
@@ -282,52 +460,255 @@ void ZygiskContext::fork_post() {
     sigmask(SIG_UNBLOCK, SIGCHLD);
 }
 
-/* Zygisksu changed: Load module fds */
-void ZygiskContext::run_modules_pre() {
+// Modules declaring zygote residency are loaded and relocated once here,
+// children inherit them copy-on-write and only run the per-process callbacks.
+// Their constructors run inside zygote, so they must not spawn threads.
+// Other modules get an address range reserved, children load them there.
+void ZygiskContext::preload_modules() {
+    if (g_hook->modules_preloaded) return;
+    g_hook->modules_preloaded = true;
+    g_hook->flags_table.Map();
+
     auto ms = zygiskd::ReadModules();
-    auto size = ms.size();
-    for (size_t i = 0; i < size; i++) {
-        auto &m = ms[i];
+    size_t loaded = 0;
+    std::vector<MappedRegion> regions;
+    for (auto &m : ms) {
+        if (!(m.flags & zygiskd::ZYGOTE_RESIDENT)) {
+            if (size_t size = GetLoadSize(m.memfd)) {
+                void *addr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (addr == MAP_FAILED) continue;
+                if (m.index >= g_hook->module_reservations.size()) {
+                    g_hook->module_reservations.resize(m.index + 1, {nullptr, 0});
+                }
+                g_hook->module_reservations[m.index] = {addr, size};
+            }
+            continue;
+        }
         if (void *handle = DlopenMem(m.memfd, RTLD_NOW);
             void *entry = handle ? dlsym(handle, "zygisk_module_entry") : nullptr) {
-            modules.emplace_back(i, handle, entry);
+            LOGD("module [%s] is resident in zygote", m.name.data());
+            g_hook->resident_modules.emplace_back(m.name, entry);
+            GetLibraryRegions(entry, false, regions);
+            loaded++;
+        }
+    }
+
+    if (loaded > 0) {
+        clean_trace("jit-cache-zygisk", loaded, 0, regions);
+    }
+}
+
+static void release_module_reservation(size_t index) {
+    if (index >= g_hook->module_reservations.size()) return;
+    auto &[addr, size] = g_hook->module_reservations[index];
+    if (addr != nullptr) munmap(addr, size);
+    addr = nullptr;
+}
+
+// shared_relro is set when RELRO was mapped from the shared relro file instead of the module
+static void *load_module(const zygiskd::Module &m, size_t index, bool &shared_relro) {
+    shared_relro = false;
+    if (index >= g_hook->module_reservations.size() ||
+        g_hook->module_reservations[index].first == nullptr) {
+        return DlopenMem(m.memfd, RTLD_NOW);
+    }
+
+    auto [addr, size] = g_hook->module_reservations[index];
+    bool write_relro = m.relro_mode == zygiskd::RelroMode::Write;
+    int relro_fd = m.relro_mode == zygiskd::RelroMode::None ? -1 : (int) m.relro_fd;
+    void *handle = DlopenMem(m.memfd, RTLD_NOW, addr, size, relro_fd, write_relro);
+    if (write_relro) zygiskd::ReportModuleRelro(index, handle != nullptr);
+    if (handle != nullptr) {
+        shared_relro = relro_fd >= 0;
+        return handle;
+    }
+
+    // The failed attempt may have left anything in the reserved range
+    release_module_reservation(index);
+    return DlopenMem(m.memfd, RTLD_NOW);
+}
+
+static uint32_t mapped_kb(const std::vector<MappedRegion> &regions) {
+    size_t size = 0;
+    for (auto &region : regions) size += region.end - region.start;
+    return size / 1024;
+}
+
+/* Zygisksu changed: Load module fds */
+void ZygiskContext::run_modules_pre() {
+    auto ms = std::move(specialize_info.modules);
+    for (auto &m : ms) {
+        size_t i = m.index;
+        if (m.flags & zygiskd::ZYGOTE_RESIDENT) {
+            auto it = std::find_if(g_hook->resident_modules.begin(),
+                                   g_hook->resident_modules.end(),
+                                   [&](auto &r) { return r.first == m.name; });
+            if (it != g_hook->resident_modules.end()) {
+                auto &module = modules.emplace_back(i, nullptr, it->second, m.flags);
+                std::vector<MappedRegion> regions;
+                GetLibraryRegions(it->second, false, regions);
+                module.cost.mapped_kb = mapped_kb(regions);
+                continue;
+            }
+        }
+        bool shared_relro;
+        void *handle;
+        {
+            timing::Scope scope(timing::Phase::LoadModule, i);
+            handle = load_module(m, i, shared_relro);
+        }
+        if (handle == nullptr) {
+            release_module_reservation(i);
+            continue;
+        }
+        void *entry = dlsym(handle, "zygisk_module_entry");
+        if (entry != nullptr) {
+            modules.emplace_back(i, handle, entry, m.flags);
+        }
+        // Reserved modules are loaded at the start of their reservation
+        void *addr = entry;
+        if (addr == nullptr && i < g_hook->module_reservations.size()) {
+            addr = g_hook->module_reservations[i].first;
+        }
+        if (addr != nullptr) {
+            std::vector<MappedRegion> regions;
+            GetLibraryRegions(addr, shared_relro, regions);
+            for (auto &region : regions) module_regions.emplace_back(i, region);
+            if (entry != nullptr) modules.back().cost.mapped_kb = mapped_kb(regions);
+        }
+    }
+
+    // Modules not targeting this process leave their reservations unused
+    for (size_t i = 0; i < g_hook->module_reservations.size(); i++) {
+        if (std::none_of(ms.begin(), ms.end(), [&](auto &m) { return m.index == i; })) {
+            release_module_reservation(i);
         }
     }
 
     for (auto &m : modules) {
-        m.onLoad(env);
+        if (m.getModuleFlags() & zygiskd::DEFERRED_PLT_COMMIT) {
+            flags |= DEFER_PLT_COMMIT;
+        } else {
+            flags &= ~DEFER_PLT_COMMIT;
+        }
+        active_module = &m;
+        {
+            timing::Scope scope(timing::Phase::ModuleOnLoad, m.getId());
+            m.onLoad(env);
+        }
+        timing::Scope scope(timing::Phase::ModulePreSpecialize, m.getId());
         if (flags & APP_SPECIALIZE) {
             m.preAppSpecialize(args.app);
         } else if (flags & SERVER_FORK_AND_SPECIALIZE) {
             m.preServerSpecialize(args.server);
         }
     }
+    active_module = nullptr;
+    flags &= ~DEFER_PLT_COMMIT;
+
+    if (flags & PLT_COMMIT_PENDING) {
+        flags &= ~PLT_COMMIT_PENDING;
+        if (!commit_plt_hooks()) LOGE("deferred plt_hook commit failed");
+    }
 }
 
 void ZygiskContext::run_modules_post() {
+    timing::Scope scope(timing::Phase::RunModulesPost);
     flags |= POST_SPECIALIZE;
 
+    size_t modules_loaded = 0;
     size_t modules_unloaded = 0;
-    for (const auto &m : modules) {
-        if (flags & APP_SPECIALIZE) {
-            m.postAppSpecialize(args.app);
-        } else if (flags & SERVER_FORK_AND_SPECIALIZE) {
-            m.postServerSpecialize(args.server);
+    std::vector<size_t> unloaded;
+    for (auto &m : modules) {
+        if (!m.isResident()) modules_loaded++;
+        active_module = &m;
+        {
+            timing::Scope scope(timing::Phase::ModulePostSpecialize, m.getId());
+            if (flags & APP_SPECIALIZE) {
+                m.postAppSpecialize(args.app);
+            } else if (flags & SERVER_FORK_AND_SPECIALIZE) {
+                m.postServerSpecialize(args.server);
+            }
+        }
+        active_module = nullptr;
+        m.closeCompanion();
+        if (m.tryUnload()) {
+            // The linker leaves a reserved range mapped after unloading
+            release_module_reservation(m.getId());
+            unloaded.push_back(m.getId());
+            modules_unloaded++;
+            m.cost.unloaded = true;
+        }
+        // system_server reported its module costs already
+        if (flags & APP_SPECIALIZE) timing::RecordModule(m.getId(), m.cost);
+    }
+
+    if (modules_loaded > 0) {
+        LOGD("modules unloaded: %zu/%zu", modules_unloaded, modules_loaded);
+        std::vector<MappedRegion> regions;
+        for (auto &[index, region] : module_regions) {
+            if (std::find(unloaded.begin(), unloaded.end(), index) == unloaded.end()) {
+                regions.push_back(region);
+            }
         }
-        if (m.tryUnload()) modules_unloaded++;
+        timing::Scope scope(timing::Phase::CleanTrace);
+        clean_trace("jit-cache-zygisk", modules_loaded, modules_unloaded, regions);
     }
+}
+
+// No module targets this uid, everything else zygiskd would reply is in the flags table
+static bool flags_table_suffices(uid_t uid, uint32_t &cached_flags) {
+    uint32_t module_count;
+    return g_hook->flags_table.Lookup(uid, cached_flags, module_count) && module_count == 0;
+}
 
-    if (modules.size() > 0) {
-        LOGD("modules unloaded: %zu/%zu", modules_unloaded, modules.size());
-        clean_trace("jit-cache-zygisk", modules.size(), modules_unloaded, true);
+// Zygote asks for the specialize info of the child ahead of forking, zygiskd prepares the reply
+// while zygote reserves modules, holds namespaces and forks, and the child only collects it
+void ZygiskContext::prefetch_specialize_info() {
+    uint32_t cached_flags;
+    if (!(flags & PROCESS_FLAGS_FETCHED) && flags_table_suffices(args.app->uid, cached_flags)) {
+        return;
     }
+    specialize_info_fd = zygiskd::RequestSpecializeInfo(args.app->uid, false);
+}
+
+// The connection is no fd zygote knows of, so it is gone before the fd checks of the fork
+void ZygiskContext::drop_prefetched_info() {
+    if (specialize_info_fd < 0) return;
+    close(specialize_info_fd);
+    std::erase(allowed_fds, specialize_info_fd);
+    specialize_info_fd = -1;
 }
 
 void ZygiskContext::app_specialize_pre() {
-    if (!(flags & APP_FORK_AND_SPECIALIZE)) {
-        // Avoid fetching process flags twice
-        info_flags = zygiskd::GetProcessFlags(args.app->uid);
+    uint32_t cached_flags;
+    if (specialize_info_fd < 0 && !(flags & PROCESS_FLAGS_FETCHED) &&
+        flags_table_suffices(args.app->uid, cached_flags)) {
+        info_flags = cached_flags;
+        flags |= PROCESS_FLAGS_FETCHED;
+        specialize_info.flags = cached_flags;
+        bool root = cached_flags & (PROCESS_IS_MANAGER | PROCESS_GRANTED_ROOT);
+        specialize_info.mount_namespace =
+            root ? zygiskd::MountNamespace::Root : zygiskd::MountNamespace::Module;
+        if (!(cached_flags & PROCESS_ON_DENYLIST)) {
+            specialize_info.mount_namespace_path =
+                g_hook->flags_table.MountNamespacePath(specialize_info.mount_namespace);
+        }
+    } else {
+        timing::Scope scope(timing::Phase::GetSpecializeInfo);
+        if (specialize_info_fd >= 0) {
+            specialize_info = zygiskd::ReadSpecializeInfo(specialize_info_fd);
+            drop_prefetched_info();
+        } else {
+            specialize_info = zygiskd::GetSpecializeInfo(args.app->uid, false);
+        }
+        if (!(flags & PROCESS_FLAGS_FETCHED)) {
+            // Zygote may have fetched them already, and only that reply carries IS_FIRST_PROCESS
+            info_flags = specialize_info.flags;
+            flags |= PROCESS_FLAGS_FETCHED;
+        }
     }
+    g_hook->flags_table.Unmap();
 
     if ((info_flags & IS_FIRST_PROCESS) && !g_hook->zygote_unmounted) {
         zygiskd::CacheMountNamespace(getpid());
@@ -340,10 +721,18 @@ void ZygiskContext::app_specialize_pre() {
 
     flags |= APP_SPECIALIZE;
     run_modules_pre();
+
+    // The app domain cannot connect to zygiskd, it inherits this connection for its report.
+    // Without fds_to_ignore it would be closed by sanitize_fds, so report what we have now.
+    if (int fd = timing::OpenReport(); fd >= 0 && !exempt_fd(fd)) {
+        timing::Report(false, args.app->uid);
+    }
 }
 
 void ZygiskContext::app_specialize_post() {
     run_modules_post();
+    // Only zygote holds on to the namespaces
+    close_mount_namespaces();
 
     if ((info_flags & (PROCESS_IS_MANAGER | PROCESS_ROOT_IS_MAGISK)) ==
         (PROCESS_IS_MANAGER | PROCESS_ROOT_IS_MAGISK)) {
@@ -353,11 +742,25 @@ void ZygiskContext::app_specialize_post() {
 
     // Cleanups
     env->ReleaseStringUTFChars(args.app->nice_name, process);
+    timing::Report(false, args.app->uid);
 }
 
 void ZygiskContext::server_specialize_pre() {
+    {
+        timing::Scope scope(timing::Phase::GetSpecializeInfo);
+        specialize_info = zygiskd::GetSpecializeInfo(args.server->uid, true);
+    }
+    g_hook->flags_table.Unmap();
     run_modules_pre();
     zygiskd::SystemServerStarted();
+    // Zygote checks the fds of system_server against its own, so no connection may be kept
+    // open for the post phase and only the pre phase is reported. Whether modules unload is
+    // only known after the post phase.
+    for (auto &m : modules) {
+        timing::RecordModule(m.getId(), m.cost);
+    }
+    timing::OpenReport();
+    timing::Report(true, args.server->uid);
 }
 
 void ZygiskContext::server_specialize_post() { run_modules_post(); }
@@ -381,6 +784,8 @@ void ZygiskContext::nativeForkSystemServer_pre() {
     LOGV("pre forkSystemServer\n");
     flags |= SERVER_FORK_AND_SPECIALIZE;
 
+    // Nothing reports held fds to the fd checks of this fork
+    close_mount_namespaces();
     fork_pre();
     if (is_child()) {
         server_specialize_pre();
@@ -401,9 +806,15 @@ void ZygiskContext::nativeForkAndSpecialize_pre() {
     LOGV("pre forkAndSpecialize [%s]\n", process);
     flags |= APP_FORK_AND_SPECIALIZE;
 
-    info_flags = zygiskd::GetProcessFlags(args.app->uid);
-
     if (!g_hook->zygote_unmounted) {
+        // Zygote itself only needs process flags to find out the first process,
+        // the forked child fetches everything else with a single request
+        {
+            timing::Scope scope(timing::Phase::GetProcessFlags);
+            info_flags = zygiskd::GetProcessFlags(args.app->uid);
+        }
+        flags |= PROCESS_FLAGS_FETCHED;
+
         // Cache mount profiles if not done
         if (info_flags & IS_FIRST_PROCESS) {
             zygiskd::CacheMountNamespace(getpid());
@@ -415,9 +826,13 @@ void ZygiskContext::nativeForkAndSpecialize_pre() {
         LOGV("zygote process mounting points cleared");
     }
 
+    prefetch_specialize_info();
+    hold_mount_namespaces();
     fork_pre();
     if (is_child()) {
         app_specialize_pre();
+    } else {
+        drop_prefetched_info();
     }
     sanitize_fds();
 }
@@ -433,7 +848,18 @@ void ZygiskContext::nativeForkAndSpecialize_post() {
 // -----------------------------------------------------------------
 
 bool ZygiskContext::update_mount_namespace(zygiskd::MountNamespace namespace_type) {
-    std::string ns_path = zygiskd::UpdateMountNamespace(namespace_type);
+    timing::Scope scope(timing::Phase::UpdateMountNamespace);
+    if (int held = g_hook->mount_namespace_fds[(int) namespace_type];
+        held >= 0 && setns(held, CLONE_NEWNS) == 0) {
+        LOGD("set mount namespace to held fd=[%d]\n", held);
+        return true;
+    }
+
+    // Prefer the namespace already sent along with the specialize info
+    std::string ns_path = (namespace_type == specialize_info.mount_namespace)
+                              ? std::move(specialize_info.mount_namespace_path)
+                              : std::string();
+    if (ns_path.empty()) ns_path = zygiskd::UpdateMountNamespace(namespace_type);
     if (!ns_path.starts_with("/proc/")) {
         PLOGE("update mount namespace [%s]", ns_path.data());
         return false;
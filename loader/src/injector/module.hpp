@@ -8,8 +8,11 @@
 #include <vector>
 
 #include "api.hpp"
+#include "arena.hpp"
 #include "daemon.hpp"
+#include "dl.hpp"
 #include "lsplt.hpp"
+#include "timing.hpp"
 
 struct ZygiskContext;
 struct HookContext;
@@ -205,21 +208,39 @@ struct ZygiskModule {
 
     bool valid() const;
     int connectCompanion() const;
+    void closeCompanion() const;
     int getModuleDir() const;
     void setOption(zygisk::Option opt);
     static uint32_t getFlags();
     bool tryUnload() const;
+    // Resident modules are owned by zygote and never unloaded in children
+    bool isResident() const { return handle == nullptr; }
     void clearApi() { memset(&api, 0, sizeof(api)); }
     int getId() const { return id; }
+    uint32_t getModuleFlags() const { return module_flags; }
 
-    ZygiskModule(int id, void *handle, void *entry);
+    ZygiskModule(int id, void *handle, void *entry, uint32_t module_flags);
 
     static bool RegisterModuleImpl(ApiTable *api, long *module);
 
+    // Reported to zygiskd once the module ran its post callback
+    timing::ModuleCost cost;
+    // Hooks queued in lsplt and not committed yet
+    uint32_t plt_hooks_pending = 0;
+    // Some of them fill a backup, so their commit must not be deferred
+    bool plt_backups_pending = false;
+
 private:
     const int id;
+    const uint32_t module_flags;
     bool unload = false;
 
+    // Connection shared by all connectCompanion calls with REUSE_COMPANION, with the
+    // identity of its socket in case sanitizing fds closed it and the number got reused
+    mutable int companion_fd = -1;
+    mutable dev_t companion_dev = 0;
+    mutable ino_t companion_ino = 0;
+
     void *const handle;
     union {
         void *const ptr;
@@ -245,6 +266,9 @@ enum : uint32_t {
     SERVER_FORK_AND_SPECIALIZE = (1u << 3),
     DO_REVERT_UNMOUNT = (1u << 4),
     SKIP_CLOSE_LOG_PIPE = (1u << 5),
+    PROCESS_FLAGS_FETCHED = (1u << 6),
+    DEFER_PLT_COMMIT = (1u << 7),
+    PLT_COMMIT_PENDING = (1u << 8),
 };
 
 #define DCL_PRE_POST(name)                                                                         \
@@ -260,33 +284,55 @@ struct ZygiskContext {
     } args;
 
     const char *process;
-    std::list<ZygiskModule> modules;
+    arena::List<ZygiskModule> modules;
 
     pid_t pid;
     uint32_t flags;
     uint32_t info_flags;
-    std::vector<bool> allowed_fds;
-    std::vector<int> exempted_fds;
+    // Fds allowed to stay open after specialization, sorted by sanitize_fds before closing
+    arena::Vector<int> allowed_fds;
+    arena::Vector<int> exempted_fds;
+    // File-backed regions of the modules loaded in this process, by module index
+    arena::Vector<std::pair<size_t, MappedRegion>> module_regions;
+    zygiskd::SpecializeInfo specialize_info;
+    // Connection zygote requested specialize_info on before forking, the child reads the reply
+    int specialize_info_fd = -1;
+    // Module whose callback is running, hooks registered meanwhile are accounted to it
+    ZygiskModule *active_module = nullptr;
+
+    // A path regex, compared as a plain string when it only anchors a literal
+    struct PathRegex {
+        enum class Literal : uint8_t { None, Exact, Prefix, Suffix, Substring };
 
-    struct RegisterInfo {
         regex_t regex;
+        Literal kind;
+        std::string literal;
+
+        bool compile(const char *pattern);
+        bool matches(const std::string &path) const;
+    };
+
+    struct RegisterInfo {
+        PathRegex regex;
         std::string symbol;
         void *callback;
         void **backup;
+        ZygiskModule *module;
     };
 
     struct IgnoreInfo {
-        regex_t regex;
+        PathRegex regex;
         std::string symbol;
     };
 
     pthread_mutex_t hook_info_lock;
-    std::vector<RegisterInfo> register_info;
-    std::vector<IgnoreInfo> ignore_info;
+    arena::Vector<RegisterInfo> register_info;
+    arena::Vector<IgnoreInfo> ignore_info;
 
     ZygiskContext(JNIEnv *env, void *args);
     ~ZygiskContext();
 
+    void preload_modules();
     void run_modules_pre();
     void run_modules_post();
     DCL_PRE_POST(fork)
@@ -297,6 +343,10 @@ struct ZygiskContext {
     DCL_PRE_POST(nativeForkSystemServer)
 
     void sanitize_fds();
+    void ignore_fds(std::span<const int> fds);
+    void hold_mount_namespaces();
+    void prefetch_specialize_info();
+    void drop_prefetched_info();
     bool exempt_fd(int fd);
     bool can_exempt_fd() const;
     bool is_child() const { return pid <= 0; }
@@ -307,14 +357,20 @@ struct ZygiskContext {
     void plt_hook_process_regex();
 
     bool plt_hook_commit();
+    bool defer_plt_commit();
+    bool commit_plt_hooks();
 
-    static bool update_mount_namespace(zygiskd::MountNamespace namespace_type);
+    bool update_mount_namespace(zygiskd::MountNamespace namespace_type);
 };
 
 #undef DCL_PRE_POST
 
 using JNIMethods = std::span<JNINativeMethod>;
 
+namespace lsplant::art {
+class ArtMethod;
+}
+
 struct HookContext {
 #include "jni_hooks.hpp"
 
@@ -325,8 +381,24 @@ struct HookContext {
     bool zygote_unmounted = false;
     jint MODIFIER_NATIVE = 0;
     jmethodID member_getModifiers = nullptr;
+    // Hooked zygote methods with their original JNI entries, restored without reflection
+    std::vector<std::pair<lsplant::art::ArtMethod *, void *>> zygote_art_methods;
     std::vector<lsplt::MapInfo> cached_map_infos = {};
-    std::vector<std::tuple<dev_t, ino_t, const char *, void **>> plt_backup;
+    std::vector<std::tuple<dev_t, ino_t, const char *, void *, void **>> plt_backup;
+    // Patched GOT slots with their original values, restored directly when unloading
+    std::vector<std::pair<GotSlot, void *>> plt_slots;
+    bool plt_slots_recorded = true;
+    bool modules_preloaded = false;
+    // Entry points of modules loaded in zygote, keyed by module name
+    std::vector<std::pair<std::string, void *>> resident_modules;
+    // Address ranges reserved in zygote for each module, so that they load at the same
+    // address in all children and can share their RELRO sections
+    std::vector<std::pair<void *, size_t>> module_reservations;
+    // Process flags cached by zygiskd, mapped in zygote and dropped in children
+    zygiskd::FlagsTable flags_table;
+    // Cached mount namespaces held open by zygote, indexed by MountNamespace
+    int mount_namespace_fds[3] = {-1, -1, -1};
+    uint32_t mount_namespace_generation = 0;
 
     HookContext(void *start_addr, size_t block_size);
 
@@ -335,8 +407,12 @@ struct HookContext {
     void restore_plt_hook();
     void hook_zygote_jni();
     void restore_zygote_hook(JNIEnv *env);
-    void hook_jni_methods(JNIEnv *env, const char *clz, JNIMethods methods);
+    void hook_jni_methods(
+        JNIEnv *env, const char *clz, JNIMethods methods,
+        std::vector<std::pair<lsplant::art::ArtMethod *, void *>> *art_methods = nullptr);
 
 private:
     void register_hook(dev_t dev, ino_t inode, const char *symbol, void *new_func, void **old_func);
+    void record_plt_slots(size_t first);
+    bool restore_plt_slots();
 };
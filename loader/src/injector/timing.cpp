@@ -0,0 +1,151 @@
+#include "timing.hpp"
+
+#include <dlfcn.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string_view>
+
+#include "daemon.hpp"
+#include "logging.hpp"
+
+namespace timing {
+
+// Wire format of zygiskd, see SAMPLE_SIZE in zygiskd/src/timings.rs
+struct Sample {
+    uint32_t phase;
+    uint32_t module;
+    uint32_t micros;
+};
+
+// See MODULE_SAMPLE_SIZE in zygiskd/src/timings.rs
+struct ModuleSample {
+    uint32_t module;
+    uint32_t micros;
+    uint32_t mapped_kb;
+    uint32_t plt_hooks_registered;
+    uint32_t plt_hooks_committed;
+    uint32_t unloaded;
+};
+
+static constexpr size_t kCapacity = 64;
+static Sample samples[kCapacity];
+static size_t sample_count = 0;
+
+static constexpr size_t kModuleCapacity = 32;
+static ModuleSample module_samples[kModuleCapacity];
+static size_t module_count = 0;
+
+static uint64_t fork_ns = 0;
+static int report_fd = -1;
+
+static const char *const kPhaseNames[] = {
+    "zygisk:fork_pre",          "zygisk:GetProcessFlags", "zygisk:GetSpecializeInfo",
+    "zygisk:update_mount_ns",   "zygisk:DlopenMem",       "zygisk:onLoad",
+    "zygisk:pre_specialize",    "zygisk:sanitize_fds",    "zygisk:post_specialize",
+    "zygisk:run_modules_post",  "zygisk:clean_trace",     "zygisk:specialize",
+};
+
+// Resolved from libandroid once. Zygote preloads it with System.loadLibrary, which keeps it
+// out of the global lookup scope, so it is found through its own handle.
+struct ATrace {
+    bool (*is_enabled)() = nullptr;
+    void (*begin_section)(const char *) = nullptr;
+    void (*end_section)() = nullptr;
+
+    ATrace() {
+        void *handle = dlopen("libandroid.so", RTLD_NOW | RTLD_NOLOAD);
+        if (handle) {
+            is_enabled =
+                reinterpret_cast<decltype(is_enabled)>(dlsym(handle, "ATrace_isEnabled"));
+            begin_section = reinterpret_cast<decltype(begin_section)>(
+                dlsym(handle, "ATrace_beginSection"));
+            end_section =
+                reinterpret_cast<decltype(end_section)>(dlsym(handle, "ATrace_endSection"));
+        }
+        if (!is_enabled || !begin_section || !end_section) {
+            LOGW("ATrace is unavailable, phases are not traced");
+            is_enabled = nullptr;
+        }
+    }
+};
+
+static const ATrace &atrace() {
+    static ATrace instance;
+    return instance;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t micros_since(uint64_t start_ns) {
+    uint64_t micros = (now_ns() - start_ns) / 1000;
+    return static_cast<uint32_t>(micros > UINT32_MAX ? UINT32_MAX : micros);
+}
+
+void Reset() {
+    sample_count = 0;
+    module_count = 0;
+    fork_ns = 0;
+}
+
+void MarkFork() { fork_ns = now_ns(); }
+
+void RecordModule(uint32_t module, const ModuleCost &cost) {
+    if (module_count == kModuleCapacity) return;
+    uint64_t micros = 0;
+    for (size_t i = 0; i < sample_count; i++) {
+        if (samples[i].module == module) micros += samples[i].micros;
+    }
+    if (micros > UINT32_MAX) micros = UINT32_MAX;
+    module_samples[module_count++] = {module,
+                                      static_cast<uint32_t>(micros),
+                                      cost.mapped_kb,
+                                      cost.plt_hooks_registered,
+                                      cost.plt_hooks_committed,
+                                      cost.unloaded};
+}
+
+int OpenReport() {
+    if (report_fd < 0) report_fd = zygiskd::ConnectTimingReport();
+    return report_fd;
+}
+
+void Report(bool is_system_server, uid_t uid) {
+    if (report_fd < 0) return;
+    // Specialized USAP processes were forked long before, system_server reports before its
+    // post specialize callbacks
+    if (fork_ns != 0 && !is_system_server && sample_count < kCapacity) {
+        samples[sample_count++] = {static_cast<uint32_t>(Phase::Specialize), kNoModule,
+                                   micros_since(fork_ns)};
+    }
+    // zygiskd is already waiting for the report once the connection is open
+    zygiskd::ReportTimings(
+        report_fd, is_system_server, uid,
+        {reinterpret_cast<const char *>(samples), sample_count * sizeof(Sample)},
+        {reinterpret_cast<const char *>(module_samples), module_count * sizeof(ModuleSample)});
+    close(report_fd);
+    report_fd = -1;
+    Reset();
+}
+
+Scope::Scope(Phase phase, uint32_t module)
+    : phase_(phase), module_(module), start_(now_ns()), traced_(false) {
+    auto &trace = atrace();
+    if (trace.is_enabled && trace.is_enabled()) {
+        trace.begin_section(kPhaseNames[static_cast<uint32_t>(phase)]);
+        traced_ = true;
+    }
+}
+
+Scope::~Scope() {
+    if (traced_) atrace().end_section();
+    // Later samples of a full ring are dropped
+    if (sample_count == kCapacity) return;
+    samples[sample_count++] = {static_cast<uint32_t>(phase_), module_, micros_since(start_)};
+}
+
+}  // namespace timing
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+
+// Durations of the phases of a specialization, collected in a fixed buffer and aggregated by
+// zygiskd. Zygote starts a new ring for every fork, children inherit and complete it.
+namespace timing {
+
+// Matches PHASE_NAMES in zygiskd/src/timings.rs
+enum class Phase : uint32_t {
+    ForkPre,
+    GetProcessFlags,
+    GetSpecializeInfo,
+    UpdateMountNamespace,
+    LoadModule,
+    ModuleOnLoad,
+    ModulePreSpecialize,
+    SanitizeFds,
+    ModulePostSpecialize,
+    RunModulesPost,
+    CleanTrace,
+    // From right before zygote forks to the end of the post specialize callbacks, apps only
+    Specialize,
+};
+
+constexpr uint32_t kNoModule = UINT32_MAX;
+
+// What a module cost this process besides the time spent in its callbacks
+struct ModuleCost {
+    uint32_t mapped_kb = 0;
+    uint32_t plt_hooks_registered = 0;
+    uint32_t plt_hooks_committed = 0;
+    bool unloaded = false;
+};
+
+void Reset();
+
+// Zygote is about to fork the child being specialized
+void MarkFork();
+
+// Recorded along with the total time of the module's samples so far
+void RecordModule(uint32_t module, const ModuleCost &cost);
+
+// Connects to zygiskd for Report while the process still runs in the domain of zygote. Returns
+// the connection, which has to survive sanitize_fds, or -1.
+int OpenReport();
+
+// Send the recorded samples and module costs to zygiskd over the connection of OpenReport and
+// close it. Nothing is sent without one, so a process reports at most once.
+void Report(bool is_system_server, uid_t uid);
+
+// Records its lifetime, also as an ATrace section while tracing is enabled
+class Scope {
+public:
+    explicit Scope(Phase phase, uint32_t module = kNoModule);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    Phase phase_;
+    uint32_t module_;
+    uint64_t start_;
+    bool traced_;
+};
+
+}  // namespace timing
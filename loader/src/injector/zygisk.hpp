@@ -3,8 +3,15 @@
 #include <jni.h>
 #include <sys/types.h>
 
+#include <vector>
+
+#include "dl.hpp"
+
 void hook_entry(void *start_addr, size_t block_size);
 
 void hookJniNativeMethods(JNIEnv *env, const char *clz, JNINativeMethod *methods, int numMethods);
 
-void clean_trace(const char *path, size_t load, size_t unload, bool spoof_maps);
+// Drop path from the linker's records and replace the given regions of loaded libraries
+// with anonymous copies, so that they no longer show up by name in maps
+void clean_trace(const char *path, size_t load, size_t unload,
+                 const std::vector<MappedRegion> &regions = {});
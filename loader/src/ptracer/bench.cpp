@@ -0,0 +1,243 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/system_properties.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "daemon.hpp"
+#include "files.hpp"
+#include "main.hpp"
+#include "misc.hpp"
+
+using namespace std::string_view_literals;
+
+// Cold starts target packages over and over, once with modules loaded, once with modules
+// scoped out of the packages and once with NeoZygisk stopped, to compare their latencies.
+// Stopping NeoZygisk restarts zygote, which restarts the whole framework, twice.
+
+enum BenchMode { MODULES_LOADED, MODULES_SCOPED_OUT, NEOZYGISK_STOPPED };
+
+static const char *const kModeNames[] = {"modules loaded", "modules scoped out",
+                                         "NeoZygisk stopped"};
+
+struct Target {
+    std::string package;
+    std::string component;
+    uid_t uid = 0;
+};
+
+struct Samples {
+    // Milliseconds from the launch intent to the first frame, as reported by am
+    std::vector<long> first_frame_ms;
+    // Microseconds from fork to the end of postAppSpecialize, as reported by zygiskd
+    std::vector<uint32_t> specialize_us;
+    std::vector<long> rss_kb;
+};
+
+static std::string run_command(const std::string &command) {
+    std::string output;
+    FILE *fp = popen(command.data(), "r");
+    if (fp == nullptr) return output;
+    char buf[4096];
+    for (size_t len; (len = fread(buf, 1, sizeof(buf), fp)) > 0;) output.append(buf, len);
+    pclose(fp);
+    return output;
+}
+
+static bool resolve_target(Target &target) {
+    struct stat st;
+    if (stat(("/data/data/" + target.package).data(), &st) != 0) return false;
+    target.uid = st.st_uid;
+    // The component is printed on the last line
+    std::string output = run_command("cmd package resolve-activity --brief -c "
+                                     "android.intent.category.LAUNCHER " +
+                                     target.package);
+    std::string_view lines = output;
+    for (size_t end; !lines.empty(); lines.remove_prefix(end + 1)) {
+        end = std::min(lines.find('\n'), lines.size() - 1);
+        std::string_view line = lines.substr(0, lines[end] == '\n' ? end : end + 1);
+        if (line.find('/') != std::string_view::npos) target.component = line;
+    }
+    return !target.component.empty();
+}
+
+static long parse_field(std::string_view text, std::string_view field) {
+    size_t pos = text.find(field);
+    if (pos == std::string_view::npos) return -1;
+    return strtol(text.data() + pos + field.size(), nullptr, 10);
+}
+
+static pid_t find_process(std::string_view package) {
+    auto dir = open_dir("/proc");
+    if (!dir) return -1;
+    for (dirent *entry; (entry = readdir(dir.get()));) {
+        int pid = parse_int(entry->d_name);
+        if (pid <= 0) continue;
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+        char cmdline[256] = {0};
+        if (auto fp = open_file(path, "re")) fread(cmdline, 1, sizeof(cmdline) - 1, fp.get());
+        if (package == cmdline) return pid;
+    }
+    return -1;
+}
+
+static long process_rss_kb(pid_t pid) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+    long rss = -1;
+    file_readline(path, [&](std::string_view line) {
+        if (!line.starts_with("Rss:")) return true;
+        rss = parse_field(line, "Rss:");
+        return false;
+    });
+    return rss;
+}
+
+static void launch(const Target &target, Samples &samples) {
+    // Latencies of earlier launches would be taken for this one
+    zygiskd::TakeSpecializeLatency(target.uid);
+    std::string output = run_command("am start -W -S -n " + target.component + " 2>&1");
+    long first_frame = parse_field(output, "TotalTime: ");
+    if (first_frame < 0) {
+        printf("  launching %s failed:\n%s", target.package.data(), output.data());
+        return;
+    }
+    samples.first_frame_ms.push_back(first_frame);
+    if (uint32_t specialize = zygiskd::TakeSpecializeLatency(target.uid)) {
+        samples.specialize_us.push_back(specialize);
+    }
+    if (pid_t pid = find_process(target.package); pid > 0) {
+        if (long rss = process_rss_kb(pid); rss >= 0) samples.rss_kb.push_back(rss);
+    }
+    run_command("am force-stop " + target.package);
+    // Let the launch settle before the next one is measured
+    sleep(2);
+}
+
+// Waits for the framework to come back up after zygote restarted
+static bool restart_zygote() {
+    __system_property_set("ctl.restart", "zygote");
+    sleep(5);
+    for (int i = 0; i < 60; i++) {
+        char bootanim[PROP_VALUE_MAX] = {0};
+        __system_property_get("init.svc.bootanim", bootanim);
+        if (bootanim != "running"sv &&
+            run_command("pm path android 2>/dev/null").starts_with("package:")) {
+            // Boot completed broadcasts keep the device busy for a while
+            sleep(20);
+            return true;
+        }
+        sleep(2);
+    }
+    return false;
+}
+
+template <typename T>
+static T percentile(std::vector<T> values, double fraction) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(fraction * values.size() + 0.999999);
+    return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+}
+
+template <typename T>
+static long mean(const std::vector<T> &values) {
+    if (values.empty()) return 0;
+    long long total = 0;
+    for (T value : values) total += value;
+    return static_cast<long>(total / (long long) values.size());
+}
+
+static void print_results(const std::vector<Target> &targets,
+                          const std::vector<std::vector<Samples>> &results, bool stopped_run) {
+    BenchMode baseline = stopped_run ? NEOZYGISK_STOPPED : MODULES_SCOPED_OUT;
+    for (size_t i = 0; i < targets.size(); i++) {
+        printf("%s:\n", targets[i].package.data());
+        long baseline_rss = mean(results[baseline][i].rss_kb);
+        for (size_t mode = 0; mode < results.size(); mode++) {
+            auto &samples = results[mode][i];
+            if (samples.first_frame_ms.empty()) continue;
+            printf("  %s: %zu launches\n", kModeNames[mode], samples.first_frame_ms.size());
+            printf("    first frame: p50 %ld ms, p95 %ld ms, p99 %ld ms\n",
+                   percentile(samples.first_frame_ms, 0.5),
+                   percentile(samples.first_frame_ms, 0.95),
+                   percentile(samples.first_frame_ms, 0.99));
+            if (!samples.specialize_us.empty()) {
+                printf("    fork to postAppSpecialize: p50 %u us, p95 %u us, p99 %u us\n",
+                       percentile(samples.specialize_us, 0.5),
+                       percentile(samples.specialize_us, 0.95),
+                       percentile(samples.specialize_us, 0.99));
+            } else if (mode != NEOZYGISK_STOPPED) {
+                printf("    fork to postAppSpecialize: no specialize latency reported\n");
+            }
+            if (!samples.rss_kb.empty()) {
+                long rss = mean(samples.rss_kb);
+                printf("    rss: mean %ld KiB", rss);
+                if (mode != (size_t) baseline && baseline_rss > 0) {
+                    printf(", %+ld KiB over %s", rss - baseline_rss, kModeNames[baseline]);
+                }
+                printf("\n");
+            }
+        }
+    }
+}
+
+int run_bench(int argc, char **argv) {
+    int rounds = 10;
+    bool stopped_run = true;
+    std::vector<Target> targets;
+    for (int i = 0; i < argc; i++) {
+        if (argv[i] == "--rounds"sv && i + 1 < argc) {
+            rounds = std::max(1, atoi(argv[++i]));
+        } else if (argv[i] == "--keep-running"sv) {
+            stopped_run = false;
+        } else {
+            Target target{argv[i]};
+            if (!resolve_target(target)) {
+                printf("cannot resolve the launcher activity of %s\n", argv[i]);
+                return 1;
+            }
+            targets.push_back(std::move(target));
+        }
+    }
+    if (targets.empty()) {
+        printf("Usage: ctl bench [--rounds N] [--keep-running] <package>...\n");
+        return 1;
+    }
+
+    std::vector<std::vector<Samples>> results(stopped_run ? 3 : 2,
+                                              std::vector<Samples>(targets.size()));
+    auto run_rounds = [&](BenchMode mode) {
+        printf("measuring with %s\n", kModeNames[mode]);
+        fflush(stdout);
+        for (int round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < targets.size(); i++) launch(targets[i], results[mode][i]);
+        }
+    };
+
+    run_rounds(MODULES_LOADED);
+
+    std::vector<uint32_t> uids;
+    for (auto &target : targets) uids.push_back(target.uid);
+    zygiskd::SetScopedOutUids(uids);
+    run_rounds(MODULES_SCOPED_OUT);
+    zygiskd::SetScopedOutUids({});
+
+    if (stopped_run) {
+        send_control_command(STOP);
+        if (restart_zygote()) run_rounds(NEOZYGISK_STOPPED);
+        send_control_command(START);
+        if (!restart_zygote()) printf("framework did not come back after restarting zygote\n");
+    }
+
+    print_results(targets, results, stopped_run);
+    return 0;
+}
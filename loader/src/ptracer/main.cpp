@@ -29,6 +29,9 @@ int main(int argc, char **argv) {
         }
         return 0;
     } else if (argc >= 2 && argv[1] == "ctl"sv) {
+        if (argc >= 3 && argv[2] == "bench"sv) {
+            return run_bench(argc - 3, argv + 3);
+        }
         if (argc == 3) {
             if (argv[2] == "start"sv) {
                 send_control_command(START);
@@ -39,17 +42,21 @@ int main(int argc, char **argv) {
             } else if (argv[2] == "exit"sv) {
                 send_control_command(EXIT);
                 return 0;
+            } else if (argv[2] == "stats"sv) {
+                printf("%s", zygiskd::GetTimingStats().c_str());
+                return 0;
             }
         }
         printf("NeoZygisk Tracer %s\n", ZKSU_VERSION);
-        printf("Usage: %s ctl start|stop|exit\n", argv[0]);
+        printf("Usage: %s ctl start|stop|exit|stats|bench\n", argv[0]);
         return 1;
     } else if (argc >= 2 && argv[1] == "version"sv) {
         printf("NeoZygisk Tracer %s\n", ZKSU_VERSION);
         return 0;
     } else {
         printf("NeoZygisk Tracer %s\n", ZKSU_VERSION);
-        printf("usage: %s monitor | trace <pid> | ctl <start|stop|exit> | version\n", argv[0]);
+        printf("usage: %s monitor | trace <pid> | ctl <start|stop|exit|stats|bench> | version\n",
+               argv[0]);
         return 1;
     }
 }
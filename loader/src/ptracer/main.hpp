@@ -19,3 +19,6 @@ enum Command {
 };
 
 void send_control_command(Command cmd);
+
+// Arguments following `ctl bench`
+int run_bench(int argc, char **argv);
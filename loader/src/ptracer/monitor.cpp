@@ -59,7 +59,7 @@ public:
 
     void Loop() {
         running = true;
-        constexpr auto MAX_EVENTS = 2;
+        constexpr auto MAX_EVENTS = 8;
         struct epoll_event events[MAX_EVENTS];
         while (running) {
             int nfds = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
@@ -101,10 +101,15 @@ public:
 
 static TracingState tracing_state = TRACING;
 static std::string prop_path;
+// Whether init is seized, it is released while both zygotes run injected
+static bool init_traced = true;
+static bool init_release_requested = false;
+static bool system_server_started = false;
 
 struct Status {
     bool supported = false;
     bool zygote_injected = false;
+    pid_t zygote_pid = -1;
     bool daemon_running = false;
     pid_t daemon_pid = -1;
     std::string daemon_info;
@@ -114,6 +119,182 @@ struct Status {
 static Status status64;
 static Status status32;
 
+// Exit of an injected zygote, watched while init is released
+struct ZygoteWatcher : public EventHandler {
+    Status &status;
+    int pidfd_ = -1;
+
+    explicit ZygoteWatcher(Status &status) : status(status) {}
+
+    bool Watch(EventLoop &loop) {
+        pidfd_ = syscall(__NR_pidfd_open, status.zygote_pid, 0);
+        if (pidfd_ == -1) {
+            PLOGE("pidfd_open %d", status.zygote_pid);
+            return false;
+        }
+        if (!loop.RegisterHandler(*this, EPOLLIN)) {
+            Unwatch();
+            return false;
+        }
+        return true;
+    }
+
+    // Closing the pidfd also removes it from epoll
+    void Unwatch() {
+        if (pidfd_ >= 0) close(pidfd_);
+        pidfd_ = -1;
+    }
+
+    int GetFd() override { return pidfd_; }
+
+    void HandleEvent(EventLoop &loop, uint32_t) override;
+
+    ~ZygoteWatcher() { Unwatch(); }
+};
+
+static ZygoteWatcher zygote_watcher64{status64};
+static ZygoteWatcher zygote_watcher32{status32};
+
+// Zygotes init starts on this device, as configured by ro.zygote
+static bool zygote_expected(bool is_64bit) {
+    char zygote[PROP_VALUE_MAX] = {0};
+    __system_property_get("ro.zygote", zygote);
+    return strstr(zygote, is_64bit ? "64" : "32") != nullptr;
+}
+
+static bool zygote_is_primary(bool is_64bit) {
+    char zygote[PROP_VALUE_MAX] = {0};
+    __system_property_get("ro.zygote", zygote);
+    return std::string_view(zygote).starts_with(is_64bit ? "zygote64" : "zygote32");
+}
+
+// Every fork of init stops until the monitor resumes it, which slows down each service start.
+// Init is released once all zygotes run injected and system_server started, and only seized
+// again when a zygote exits. A zygote init starts before that is caught by restart_stray_zygotes.
+static void maybe_release_init() {
+    if (tracing_state != TRACING || !init_traced || init_release_requested ||
+        !system_server_started) {
+        return;
+    }
+    for (bool is_64bit : {true, false}) {
+        auto &status = is_64bit ? status64 : status32;
+        if (zygote_expected(is_64bit) && !(status.zygote_injected && status.zygote_pid > 0)) {
+            return;
+        }
+    }
+    LOGI("all zygotes injected, releasing init");
+    init_release_requested = true;
+    ptrace(PTRACE_INTERRUPT, 1, 0, 0);
+}
+
+static std::string read_cmdline(pid_t pid) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    char buf[256];
+    size_t len = 0;
+    if (auto fp = open_file(path, "re")) len = fread(buf, 1, sizeof(buf), fp.get());
+    return {buf, len};
+}
+
+// Parent and tracer of pid, false if it is gone
+static bool read_parent_and_tracer(pid_t pid, pid_t &parent, pid_t &tracer) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    parent = tracer = -1;
+    auto value = [](std::string_view field) {
+        return parse_int(field.substr(std::min(field.find_first_not_of(" \t"), field.size())));
+    };
+    file_readline(true, path, [&](std::string_view line) {
+        if (line.starts_with("PPid:")) {
+            parent = value(line.substr(5));
+        } else if (line.starts_with("TracerPid:")) {
+            tracer = value(line.substr(10));
+            return false;
+        }
+        return true;
+    });
+    return parent != -1 && tracer != -1;
+}
+
+static void stop_tracing(const char *reason);
+
+// Init restarts a zygote right away after a long enough run and on ctl.restart, so it may run
+// the new one before init is seized again. That zygote exec'd untraced and never gets injected,
+// it is killed for init to start it once more while traced. Forks init made meanwhile that did
+// not exec yet are waited for a little.
+static void restart_stray_zygotes() {
+    std::string init_cmdline = read_cmdline(1);
+    for (int round = 0; round < 10; round++) {
+        bool pending = false;
+        auto dir = open_dir("/proc");
+        if (!dir) return;
+        for (dirent *entry; (entry = readdir(dir.get()));) {
+            pid_t pid = parse_int(entry->d_name), parent, tracer;
+            // Everything forked since init was seized is traced by the monitor
+            if (pid <= 1 || !read_parent_and_tracer(pid, parent, tracer) || parent != 1 ||
+                tracer != 0) {
+                continue;
+            }
+            char exe[PATH_MAX];
+            char exe_link[32];
+            snprintf(exe_link, sizeof(exe_link), "/proc/%d/exe", pid);
+            ssize_t len = readlink(exe_link, exe, sizeof(exe) - 1);
+            if (len < 0) continue;
+            exe[len] = '\0';
+            if (exe == "/system/bin/init"sv) {
+                if (read_cmdline(pid) == init_cmdline) pending = true;
+                continue;
+            }
+            bool is_64bit = exe == "/system/bin/app_process64"sv;
+            if (!is_64bit && exe != "/system/bin/app_process32"sv) continue;
+            auto &status = is_64bit ? status64 : status32;
+            if (status.zygote_injected && status.zygote_pid == pid) continue;
+            LOGW("zygote%s %d started while init was released, restarting it",
+                 is_64bit ? "64" : "32", pid);
+            if (kill(pid, SIGKILL) == -1) {
+                PLOGE("kill %d", pid);
+                stop_tracing("zygote started uninjected");
+                return;
+            }
+        }
+        if (!pending) return;
+        usleep(10000);
+    }
+    LOGW("forks of init did not exec in time, zygotes among them run uninjected");
+}
+
+void ZygoteWatcher::HandleEvent(EventLoop &, uint32_t) {
+    bool is_64bit = &status == &status64;
+    LOGI("zygote%s %d exited, tracing init again", is_64bit ? "64" : "32", status.zygote_pid);
+    Unwatch();
+    status.zygote_injected = false;
+    status.zygote_pid = -1;
+    // system_server dies along with the primary zygote
+    if (zygote_is_primary(is_64bit)) system_server_started = false;
+    if (!init_traced && tracing_state == TRACING) {
+        zygote_watcher64.Unwatch();
+        zygote_watcher32.Unwatch();
+        if (ptrace(PTRACE_SEIZE, 1, 0, PTRACE_O_TRACEFORK) == -1) PLOGE("seize init");
+        init_traced = true;
+        restart_stray_zygotes();
+    }
+    updateStatus();
+}
+
+static void stop_tracing(const char *reason) {
+    tracing_state = STOPPING;
+    monitor_stop_reason = reason;
+    if (init_traced) {
+        ptrace(PTRACE_INTERRUPT, 1, 0, 0);
+        return;
+    }
+    // Init is released already, only the zygote watches are left to drop
+    zygote_watcher64.Unwatch();
+    zygote_watcher32.Unwatch();
+    tracing_state = STOPPED;
+    LOGI("stop tracing init");
+}
+
 struct SocketHandler : public EventHandler {
     struct [[gnu::packed]] MsgHead {
         Command cmd;
@@ -195,15 +376,14 @@ struct SocketHandler : public EventHandler {
                     ptrace(PTRACE_SEIZE, 1, 0, PTRACE_O_TRACEFORK);
                     LOGI("start tracing init");
                     tracing_state = TRACING;
+                    init_traced = true;
                 }
                 updateStatus();
                 break;
             case STOP:
                 if (tracing_state == TRACING) {
                     LOGI("stop tracing requested");
-                    tracing_state = STOPPING;
-                    monitor_stop_reason = "user requested";
-                    ptrace(PTRACE_INTERRUPT, 1, 0, 0);
+                    stop_tracing("user requested");
                     updateStatus();
                 }
                 break;
@@ -217,10 +397,12 @@ struct SocketHandler : public EventHandler {
             case ZYGOTE64_INJECTED:
                 status64.zygote_injected = true;
                 updateStatus();
+                maybe_release_init();
                 break;
             case ZYGOTE32_INJECTED:
                 status32.zygote_injected = true;
                 updateStatus();
+                maybe_release_init();
                 break;
             case DAEMON64_SET_INFO:
                 LOGD("received daemon64 info %s", msg.data);
@@ -246,6 +428,8 @@ struct SocketHandler : public EventHandler {
                 break;
             case SYSTEM_SERVER_STARTED:
                 LOGD("system server started, module.prop updated");
+                system_server_started = true;
+                maybe_release_init();
                 break;
             }
         }
@@ -303,10 +487,29 @@ static bool ensure_daemon_created(bool is_64bit) {
     }
 }
 
+// Called while init is stopped, which is resumed by the caller if it could not be released
+static bool release_init(EventLoop &loop) {
+    if (tracing_state != TRACING) return false;
+    bool watched = true;
+    for (bool is_64bit : {true, false}) {
+        if (!zygote_expected(is_64bit)) continue;
+        auto &watcher = is_64bit ? zygote_watcher64 : zygote_watcher32;
+        watched = watched && watcher.Watch(loop);
+    }
+    if (!watched || ptrace(PTRACE_DETACH, 1, 0, 0) == -1) {
+        zygote_watcher64.Unwatch();
+        zygote_watcher32.Unwatch();
+        LOGW("keep tracing init");
+        return false;
+    }
+    init_traced = false;
+    LOGI("init released");
+    return true;
+}
+
 struct SigChldHandler : public EventHandler {
 private:
     int signal_fd_;
-    struct signalfd_siginfo fdsi;
     int status;
     std::set<pid_t> process;
 
@@ -330,57 +533,68 @@ public:
 
     int GetFd() override { return signal_fd_; }
 
-    void HandleEvent(EventLoop &, uint32_t) override {
+    void HandleEvent(EventLoop &loop, uint32_t) override {
+        // SIGCHLD coalesces anyway, one drain of waitpid serves all the queued signals
+        bool sigchld = false;
         for (;;) {
-            ssize_t s = read(signal_fd_, &fdsi, sizeof(fdsi));
+            struct signalfd_siginfo infos[16];
+            ssize_t s = read(signal_fd_, infos, sizeof(infos));
             if (s == -1) {
-                if (errno == EAGAIN) break;
-                PLOGE("read signalfd");
-                continue;
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) PLOGE("read signalfd");
+                break;
             }
-            if (s != sizeof(fdsi)) {
-                LOGW("read %zu != %zu", s, sizeof(fdsi));
+            if (s % sizeof(infos[0]) != 0) {
+                LOGW("read %zu is not a multiple of %zu", s, sizeof(infos[0]));
                 continue;
             }
-            if (fdsi.ssi_signo != SIGCHLD) {
-                LOGW("no sigchld received");
-                continue;
+            for (size_t i = 0; i < s / sizeof(infos[0]); i++) {
+                if (infos[i].ssi_signo == SIGCHLD) {
+                    sigchld = true;
+                } else {
+                    LOGW("no sigchld received");
+                }
+            }
+        }
+        if (!sigchld) return;
+        int pid;
+        while ((pid = waitpid(-1, &status, __WALL | WNOHANG)) != 0) {
+            if (pid == -1) {
+                if (errno != ECHILD) PLOGE("waitpid");
+                break;
             }
-            int pid;
-            while ((pid = waitpid(-1, &status, __WALL | WNOHANG)) != 0) {
-                if (pid == -1) {
-                    if (tracing_state == STOPPED && errno == ECHILD) break;
-                    PLOGE("waitpid");
+            if (pid == 1) {
+                if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_FORK)) {
+                    long child_pid;
+                    ptrace(PTRACE_GETEVENTMSG, pid, 0, &child_pid);
+                    LOGV("forked %ld", child_pid);
+                } else if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_STOP) && tracing_state == STOPPING) {
+                    if (ptrace(PTRACE_DETACH, 1, 0, 0) == -1) PLOGE("failed to detach init");
+                    tracing_state = STOPPED;
+                    init_release_requested = false;
+                    LOGI("stop tracing init");
+                    continue;
+                } else if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_STOP) && init_release_requested) {
+                    init_release_requested = false;
+                    if (release_init(loop)) continue;
                 }
-                if (pid == 1) {
-                    if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_FORK)) {
-                        long child_pid;
-                        ptrace(PTRACE_GETEVENTMSG, pid, 0, &child_pid);
-                        LOGV("forked %ld", child_pid);
-                    } else if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_STOP) &&
-                               tracing_state == STOPPING) {
-                        if (ptrace(PTRACE_DETACH, 1, 0, 0) == -1) PLOGE("failed to detach init");
-                        tracing_state = STOPPED;
-                        LOGI("stop tracing init");
-                        continue;
-                    }
-                    if (WIFSTOPPED(status)) {
-                        if (WPTEVENT(status) == 0) {
-                            if (WSTOPSIG(status) != SIGSTOP && WSTOPSIG(status) != SIGTSTP &&
-                                WSTOPSIG(status) != SIGTTIN && WSTOPSIG(status) != SIGTTOU) {
-                                LOGW("inject signal sent to init: %s %d",
-                                     sigabbrev_np(WSTOPSIG(status)), WSTOPSIG(status));
-                                ptrace(PTRACE_CONT, pid, 0, WSTOPSIG(status));
-                                continue;
-                            } else {
-                                LOGW("suppress stopping signal sent to init: %s %d",
-                                     sigabbrev_np(WSTOPSIG(status)), WSTOPSIG(status));
-                            }
+                if (WIFSTOPPED(status)) {
+                    if (WPTEVENT(status) == 0) {
+                        if (WSTOPSIG(status) != SIGSTOP && WSTOPSIG(status) != SIGTSTP &&
+                            WSTOPSIG(status) != SIGTTIN && WSTOPSIG(status) != SIGTTOU) {
+                            LOGW("inject signal sent to init: %s %d",
+                                 sigabbrev_np(WSTOPSIG(status)), WSTOPSIG(status));
+                            ptrace(PTRACE_CONT, pid, 0, WSTOPSIG(status));
+                            continue;
+                        } else {
+                            LOGW("suppress stopping signal sent to init: %s %d",
+                                 sigabbrev_np(WSTOPSIG(status)), WSTOPSIG(status));
                         }
-                        ptrace(PTRACE_CONT, pid, 0, 0);
                     }
-                    continue;
+                    ptrace(PTRACE_CONT, pid, 0, 0);
                 }
+                continue;
+            }
 #define CHECK_DAEMON_EXIT(abi)                                                                     \
     if (status##abi.supported && pid == status##abi.daemon_pid) {                                  \
         auto status_str = parse_status(status);                                                    \
@@ -392,78 +606,86 @@ public:
         updateStatus();                                                                            \
         continue;                                                                                  \
     }
-                CHECK_DAEMON_EXIT(64)
-                CHECK_DAEMON_EXIT(32)
-                auto state = process.find(pid);
-                if (state == process.end()) {
-                    LOGV("new process %d attached", pid);
-                    process.emplace(pid);
-                    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACEEXEC);
-                    ptrace(PTRACE_CONT, pid, 0, 0);
-                    continue;
-                } else {
-                    if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_EXEC)) {
-                        auto program = get_program(pid);
-                        LOGV("%d program %s", pid, program.c_str());
-                        const char *tracer = nullptr;
-                        do {
-                            if (tracing_state != TRACING) {
-                                LOGW("stop injecting %d because not tracing", pid);
-                                break;
-                            }
+            CHECK_DAEMON_EXIT(64)
+            CHECK_DAEMON_EXIT(32)
+            auto state = process.find(pid);
+            if (state == process.end()) {
+                LOGV("new process %d attached", pid);
+                process.emplace(pid);
+                ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACEEXEC);
+                ptrace(PTRACE_CONT, pid, 0, 0);
+                continue;
+            } else {
+                if (STOPPED_WITH(SIGTRAP, PTRACE_EVENT_EXEC)) {
+                    auto program = get_program(pid);
+                    LOGV("%d program %s", pid, program.c_str());
+                    const char *tracer = nullptr;
+                    // The tracer of our own ABI is this very binary, no need to exec it
+                    bool same_abi = false;
+                    do {
+                        if (tracing_state != TRACING) {
+                            LOGW("stop injecting %d because not tracing", pid);
+                            break;
+                        }
 #define PRE_INJECT(abi, is_64)                                                                     \
     if (program == "/system/bin/app_process" #abi) {                                               \
         tracer = "./bin/zygisk-ptrace" #abi;                                                       \
+        same_abi = is_64 == (sizeof(void *) == 8);                                                 \
         if (should_stop_inject##abi()) {                                                           \
             LOGW("zygote" #abi " restart too much times, stop injecting");                         \
-            tracing_state = STOPPING;                                                              \
-            monitor_stop_reason = "zygote crashed";                                                \
-            ptrace(PTRACE_INTERRUPT, 1, 0, 0);                                                     \
+            stop_tracing("zygote crashed");                                                        \
             break;                                                                                 \
         }                                                                                          \
         if (!ensure_daemon_created(is_64)) {                                                       \
             LOGW("daemon" #abi " not running, stop injecting");                                    \
-            tracing_state = STOPPING;                                                              \
-            monitor_stop_reason = "daemon not running";                                            \
-            ptrace(PTRACE_INTERRUPT, 1, 0, 0);                                                     \
+            stop_tracing("daemon not running");                                                    \
             break;                                                                                 \
         }                                                                                          \
+        status##abi.zygote_pid = pid;                                                              \
     }
-                            PRE_INJECT(64, true)
-                            PRE_INJECT(32, false)
-                            if (tracer != nullptr) {
-                                LOGD("stopping %d", pid);
-                                kill(pid, SIGSTOP);
-                                ptrace(PTRACE_CONT, pid, 0, 0);
-                                waitpid(pid, &status, __WALL);
-                                if (STOPPED_WITH(SIGSTOP, 0)) {
-                                    LOGD("detaching %d", pid);
-                                    ptrace(PTRACE_DETACH, pid, 0, SIGSTOP);
-                                    status = 0;
-                                    auto p = fork_dont_care();
-                                    if (p == 0) {
-                                        execl(tracer, basename(tracer), "trace",
-                                              std::to_string(pid).c_str(), "--restart", nullptr);
-                                        PLOGE("failed to exec, kill");
+                        PRE_INJECT(64, true)
+                        PRE_INJECT(32, false)
+                        if (tracer != nullptr) {
+                            LOGD("stopping %d", pid);
+                            kill(pid, SIGSTOP);
+                            ptrace(PTRACE_CONT, pid, 0, 0);
+                            waitpid(pid, &status, __WALL);
+                            if (STOPPED_WITH(SIGSTOP, 0)) {
+                                LOGD("detaching %d", pid);
+                                ptrace(PTRACE_DETACH, pid, 0, SIGSTOP);
+                                status = 0;
+                                auto p = fork_dont_care();
+                                if (p == 0 && same_abi) {
+                                    // The forked monitor traces zygote in place of an exec'd
+                                    // tracer, which saves loading and linking a fresh binary
+                                    zygiskd::ZygoteRestart();
+                                    if (!trace_zygote(pid)) {
                                         kill(pid, SIGKILL);
                                         exit(1);
-                                    } else if (p == -1) {
-                                        PLOGE("failed to fork, kill");
-                                        kill(pid, SIGKILL);
                                     }
+                                    exit(0);
+                                } else if (p == 0) {
+                                    execl(tracer, basename(tracer), "trace",
+                                          std::to_string(pid).c_str(), "--restart", nullptr);
+                                    PLOGE("failed to exec, kill");
+                                    kill(pid, SIGKILL);
+                                    exit(1);
+                                } else if (p == -1) {
+                                    PLOGE("failed to fork, kill");
+                                    kill(pid, SIGKILL);
                                 }
                             }
-                        } while (false);
-                        updateStatus();
-                    } else {
-                        LOGW("process %d received unknown status %s", pid,
-                             parse_status(status).c_str());
-                    }
-                    process.erase(state);
-                    if (WIFSTOPPED(status)) {
-                        LOGV("detach process %d", pid);
-                        ptrace(PTRACE_DETACH, pid, 0, 0);
-                    }
+                        }
+                    } while (false);
+                    updateStatus();
+                } else {
+                    LOGW("process %d received unknown status %s", pid,
+                         parse_status(status).c_str());
+                }
+                process.erase(state);
+                if (WIFSTOPPED(status)) {
+                    LOGV("detach process %d", pid);
+                    ptrace(PTRACE_DETACH, pid, 0, 0);
                 }
             }
         }
@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
@@ -20,6 +21,257 @@
 #include "utils.hpp"
 #include "logging.hpp"
 
+// Arguments and results of inject_stub, all fields are pointer sized
+struct InjectBlock {
+    uintptr_t dlopen;
+    uintptr_t dlsym;
+    uintptr_t dlerror;
+    uintptr_t lib_path;
+    uintptr_t dlopen_flags;
+    uintptr_t entry_name;
+    uintptr_t tmp_path;
+    // Results
+    uintptr_t handle;
+    uintptr_t entry;
+    uintptr_t error;
+};
+
+// Position independent code copied into an anonymous mapping of zygote, it calls
+// entry(nullptr, 0, tmp_path) of the dlopen-ed library and returns 1, or returns 0
+// with the dlerror() string stored in the block.
+extern "C" const uint8_t inject_stub[], inject_stub_end[];
+
+#if defined(__x86_64__)
+asm(R"(
+    .pushsection .rodata.inject_stub, "a"
+    .intel_syntax noprefix
+    .p2align 4
+    .globl inject_stub, inject_stub_end
+    .hidden inject_stub, inject_stub_end
+inject_stub:
+    push rbx
+    mov rbx, rdi
+    mov rdi, [rbx + 24]
+    mov rsi, [rbx + 32]
+    call qword ptr [rbx]
+    mov [rbx + 56], rax
+    test rax, rax
+    jz 1f
+    mov rdi, rax
+    mov rsi, [rbx + 40]
+    call qword ptr [rbx + 8]
+    mov [rbx + 64], rax
+    test rax, rax
+    jz 1f
+    xor edi, edi
+    xor esi, esi
+    mov rdx, [rbx + 48]
+    call rax
+    mov eax, 1
+    pop rbx
+    ret
+1:
+    call qword ptr [rbx + 16]
+    mov [rbx + 72], rax
+    xor eax, eax
+    pop rbx
+    ret
+inject_stub_end:
+    .att_syntax prefix
+    .popsection
+)");
+#elif defined(__i386__)
+asm(R"(
+    .pushsection .rodata.inject_stub, "a"
+    .intel_syntax noprefix
+    .p2align 4
+    .globl inject_stub, inject_stub_end
+    .hidden inject_stub, inject_stub_end
+inject_stub:
+    push ebx
+    sub esp, 24
+    mov ebx, [esp + 32]
+    mov eax, [ebx + 12]
+    mov [esp], eax
+    mov eax, [ebx + 16]
+    mov [esp + 4], eax
+    call dword ptr [ebx]
+    mov [ebx + 28], eax
+    test eax, eax
+    jz 1f
+    mov [esp], eax
+    mov eax, [ebx + 20]
+    mov [esp + 4], eax
+    call dword ptr [ebx + 4]
+    mov [ebx + 32], eax
+    test eax, eax
+    jz 1f
+    mov dword ptr [esp], 0
+    mov dword ptr [esp + 4], 0
+    mov ecx, [ebx + 24]
+    mov [esp + 8], ecx
+    call eax
+    mov eax, 1
+    add esp, 24
+    pop ebx
+    ret
+1:
+    call dword ptr [ebx + 8]
+    mov [ebx + 36], eax
+    xor eax, eax
+    add esp, 24
+    pop ebx
+    ret
+inject_stub_end:
+    .att_syntax prefix
+    .popsection
+)");
+#elif defined(__aarch64__)
+asm(R"(
+    .pushsection .rodata.inject_stub, "a"
+    .p2align 2
+    .globl inject_stub, inject_stub_end
+    .hidden inject_stub, inject_stub_end
+inject_stub:
+    stp x29, x30, [sp, #-32]!
+    mov x29, sp
+    str x19, [sp, #16]
+    mov x19, x0
+    ldr x0, [x19, #24]
+    ldr x1, [x19, #32]
+    ldr x16, [x19, #0]
+    blr x16
+    str x0, [x19, #56]
+    cbz x0, 1f
+    ldr x1, [x19, #40]
+    ldr x16, [x19, #8]
+    blr x16
+    str x0, [x19, #64]
+    cbz x0, 1f
+    mov x16, x0
+    mov x0, #0
+    mov x1, #0
+    ldr x2, [x19, #48]
+    blr x16
+    mov x0, #1
+    b 2f
+1:
+    ldr x16, [x19, #16]
+    blr x16
+    str x0, [x19, #72]
+    mov x0, #0
+2:
+    ldr x19, [sp, #16]
+    ldp x29, x30, [sp], #32
+    ret
+inject_stub_end:
+    .popsection
+)");
+#elif defined(__arm__)
+// In ARM state, remote_call clears the Thumb bit for even addresses
+asm(R"(
+    .pushsection .rodata.inject_stub, "a"
+    .arm
+    .p2align 2
+    .globl inject_stub, inject_stub_end
+    .hidden inject_stub, inject_stub_end
+inject_stub:
+    push {r4, lr}
+    mov r4, r0
+    ldr r0, [r4, #12]
+    ldr r1, [r4, #16]
+    ldr r3, [r4, #0]
+    blx r3
+    str r0, [r4, #28]
+    cmp r0, #0
+    beq 1f
+    ldr r1, [r4, #20]
+    ldr r3, [r4, #4]
+    blx r3
+    str r0, [r4, #32]
+    cmp r0, #0
+    beq 1f
+    mov r3, r0
+    mov r0, #0
+    mov r1, #0
+    ldr r2, [r4, #24]
+    blx r3
+    mov r0, #1
+    pop {r4, pc}
+1:
+    ldr r3, [r4, #8]
+    blx r3
+    str r0, [r4, #36]
+    mov r0, #0
+    pop {r4, pc}
+inject_stub_end:
+    .popsection
+)");
+#endif
+
+static_assert(offsetof(InjectBlock, error) == 9 * sizeof(uintptr_t));
+
+// Run inject_stub from a temporary anonymous mapping, so that the text of app_process stays
+// clean and shared with its file. Returns -1 if the stub could not be installed, which leaves
+// zygote untouched.
+static int inject_with_stub(int pid, struct user_regs_struct &regs, uintptr_t return_addr,
+                            const char *lib_path, uintptr_t dlopen_addr, uintptr_t dlsym_addr,
+                            uintptr_t dlerror_addr, uintptr_t mmap_addr, uintptr_t munmap_addr) {
+    size_t stub_size = inject_stub_end - inject_stub;
+    auto page_size = static_cast<size_t>(getpagesize());
+    if (stub_size > page_size) return -1;
+
+    std::vector<long> args{0,
+                           (long) page_size,
+                           PROT_READ | PROT_EXEC,
+                           MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1,
+                           0};
+    auto code_addr = remote_call(pid, regs, mmap_addr, return_addr, args);
+    if (code_addr == 0 || code_addr == (uintptr_t) MAP_FAILED) {
+        LOGE("failed to map the injection stub");
+        return -1;
+    }
+    auto unmap_stub = [&] {
+        std::vector<long> unmap_args{(long) code_addr, (long) page_size};
+        if (remote_call(pid, regs, munmap_addr, return_addr, unmap_args) != 0) {
+            LOGE("failed to unmap the injection stub at %" PRIxPTR, code_addr);
+        }
+    };
+
+    InjectBlock block{
+        .dlopen = dlopen_addr,
+        .dlsym = dlsym_addr,
+        .dlerror = dlerror_addr,
+        .lib_path = push_string(pid, regs, lib_path),
+        .dlopen_flags = RTLD_NOW,
+        .entry_name = push_string(pid, regs, "entry"),
+        .tmp_path = push_string(pid, regs, zygiskd::GetTmpPath().c_str()),
+    };
+    regs.REG_SP -= sizeof(block);
+    align_stack(regs);
+    auto block_addr = static_cast<uintptr_t>(regs.REG_SP);
+    if (write_proc(pid, block_addr, &block, sizeof(block)) != sizeof(block) ||
+        !write_proc_text(pid, code_addr, inject_stub, stub_size)) {
+        unmap_stub();
+        return -1;
+    }
+
+    args = {(long) block_addr};
+    auto result = remote_call(pid, regs, code_addr, return_addr, args);
+    unmap_stub();
+    if (result == 1) return 1;
+
+    if (read_proc(pid, block_addr, &block, sizeof(block)) == sizeof(block) && block.error != 0) {
+        char err[256]{};
+        read_proc(pid, block.error, err, sizeof(err) - 1);
+        LOGE("dlerror info %s", err);
+    } else {
+        LOGE("injection stub failed");
+    }
+    return 0;
+}
+
 bool inject_on_main(int pid, const char *lib_path) {
     LOGI("injecting %s to zygote %d", lib_path, pid);
     // parsing KernelArgumentBlock
@@ -94,13 +346,46 @@ bool inject_on_main(int pid, const char *lib_path) {
         // backup registers
         memcpy(&backup, &regs, sizeof(regs));
         map = MapInfo::Scan(std::to_string(pid));
-        auto local_map = MapInfo::Scan();
         auto libc_return_addr = find_module_return_addr(map, "libc.so");
         LOGD("libc return addr %p", libc_return_addr);
 
+        // Resolve everything we may call at once, while zygote is stopped
+        enum { DLOPEN, DLERROR, STRLEN, DLSYM, MMAP, MUNMAP };
+        RemoteSymbol symbols[] = {
+            {"libdl.so", "dlopen"}, {"libdl.so", "dlerror"}, {"libc.so", "strlen"},
+            {"libdl.so", "dlsym"},  {"libc.so", "mmap"},     {"libc.so", "munmap"},
+        };
+        if (!resolve_remote_symbols(map, symbols)) {
+            auto local_map = MapInfo::Scan();
+            for (auto &symbol : symbols) {
+                if (symbol.address != 0) continue;
+                symbol.address = (uintptr_t) find_func_addr(local_map, map, symbol.module,
+                                                            symbol.name);
+            }
+        }
+
         // call dlopen
-        auto dlopen_addr = find_func_addr(local_map, map, "libdl.so", "dlopen");
+        auto dlopen_addr = (void *) symbols[DLOPEN].address;
         if (dlopen_addr == nullptr) return false;
+
+        if (symbols[DLSYM].address != 0 && symbols[DLERROR].address != 0 &&
+            symbols[MMAP].address != 0 && symbols[MUNMAP].address != 0) {
+            int injected = inject_with_stub(
+                pid, regs, (uintptr_t) libc_return_addr, lib_path, symbols[DLOPEN].address,
+                symbols[DLSYM].address, symbols[DLERROR].address, symbols[MMAP].address,
+                symbols[MUNMAP].address);
+            if (injected == 0) return false;
+            if (injected == 1) {
+                // reset pc to entry
+                backup.REG_IP = (long) entry_addr;
+                LOGD("invoke entry");
+                // restore registers
+                return set_regs(pid, backup);
+            }
+            LOGW("failed to install injection stub, falling back to remote calls");
+            memcpy(&regs, &backup, sizeof(regs));
+        }
+
         std::vector<long> args;
         auto str = push_string(pid, regs, lib_path);
         args.clear();
@@ -112,7 +397,7 @@ bool inject_on_main(int pid, const char *lib_path) {
         if (remote_handle == 0) {
             LOGE("handle is null");
             // call dlerror
-            auto dlerror_addr = find_func_addr(local_map, map, "libdl.so", "dlerror");
+            auto dlerror_addr = (void *) symbols[DLERROR].address;
             if (dlerror_addr == nullptr) {
                 LOGE("find dlerror");
                 return false;
@@ -122,7 +407,7 @@ bool inject_on_main(int pid, const char *lib_path) {
                                                 (uintptr_t) libc_return_addr, args);
             LOGD("dlerror str %p", (void *) dlerror_str_addr);
             if (dlerror_str_addr == 0) return false;
-            auto strlen_addr = find_func_addr(local_map, map, "libc.so", "strlen");
+            auto strlen_addr = (void *) symbols[STRLEN].address;
             if (strlen_addr == nullptr) {
                 LOGE("find strlen");
                 return false;
@@ -143,7 +428,7 @@ bool inject_on_main(int pid, const char *lib_path) {
         }
 
         // call dlsym(handle, "entry")
-        auto dlsym_addr = find_func_addr(local_map, map, "libdl.so", "dlsym");
+        auto dlsym_addr = (void *) symbols[DLSYM].address;
         if (dlsym_addr == nullptr) return false;
         args.clear();
         str = push_string(pid, regs, "entry");
@@ -1,4 +1,5 @@
 #include <vector>
+#include <algorithm>
 #include <sys/mman.h>
 #include <sys/sysmacros.h>
 #include <array>
@@ -23,7 +24,10 @@
 #include <sys/stat.h>
 
 #include "utils.hpp"
+#include "elf_util.hpp"
 #include "logging.hpp"
+#include "maps.hpp"
+#include "misc.hpp"
 #include <sched.h>
 #include <fcntl.h>
 
@@ -65,41 +69,7 @@ bool switch_mnt_ns(int pid, int *fd) {
 }
 
 std::vector<MapInfo> MapInfo::Scan(const std::string& pid) {
-    constexpr static auto kPermLength = 5;
-    constexpr static auto kMapEntry = 7;
-    std::vector<MapInfo> info;
-    std::string file_name = std::string("/proc/") + pid + "/maps";
-    auto maps = std::unique_ptr<FILE, decltype(&fclose)>{fopen(file_name.c_str(), "r"), &fclose};
-    if (maps) {
-        char *line = nullptr;
-        size_t len = 0;
-        ssize_t read;
-        while ((read = getline(&line, &len, maps.get())) > 0) {
-            line[read - 1] = '\0';
-            uintptr_t start = 0;
-            uintptr_t end = 0;
-            uintptr_t off = 0;
-            ino_t inode = 0;
-            unsigned int dev_major = 0;
-            unsigned int dev_minor = 0;
-            std::array<char, kPermLength> perm{'\0'};
-            int path_off;
-            if (sscanf(line, "%" PRIxPTR "-%" PRIxPTR " %4s %" PRIxPTR " %x:%x %lu %n%*s", &start,
-                    &end, perm.data(), &off, &dev_major, &dev_minor, &inode,
-                    &path_off) != kMapEntry) {
-                continue;
-            }
-            while (path_off < read && isspace(line[path_off])) path_off++;
-            auto &ref = info.emplace_back(MapInfo{start, end, 0, perm[3] == 'p', off,
-                                                  static_cast<dev_t>(makedev(dev_major, dev_minor)),
-                                                  inode, line + path_off});
-            if (perm[0] == 'r') ref.perms |= PROT_READ;
-            if (perm[1] == 'w') ref.perms |= PROT_WRITE;
-            if (perm[2] == 'x') ref.perms |= PROT_EXEC;
-        }
-        free(line);
-    }
-    return info;
+    return ScanMaps<MapInfo>(pid == "self" ? 0 : parse_int(pid));
 }
 
 ssize_t write_proc(int pid, uintptr_t remote_addr, const void *buf, size_t len) {
@@ -139,6 +109,23 @@ ssize_t read_proc(int pid, uintptr_t remote_addr, void *buf, size_t len) {
     return l;
 }
 
+bool write_proc_text(int pid, uintptr_t remote_addr, const void *buf, size_t len) {
+    LOGV("write to remote text %" PRIxPTR " size %zu", remote_addr, len);
+    std::string path = "/proc/" + std::to_string(pid) + "/mem";
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        PLOGE("open %s", path.c_str());
+        return false;
+    }
+    auto l = pwrite64(fd, buf, len, (off64_t) remote_addr);
+    close(fd);
+    if (l == -1) {
+        PLOGE("pwrite %s", path.c_str());
+        return false;
+    }
+    return static_cast<size_t>(l) == len;
+}
+
 bool get_regs(int pid, struct user_regs_struct &regs) {
 #if defined(__x86_64__) || defined(__i386__)
     if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == -1) {
@@ -244,6 +231,54 @@ void *find_func_addr(
     return addr;
 }
 
+bool resolve_remote_symbols(std::vector<MapInfo> &remote_info, std::span<RemoteSymbol> symbols) {
+    std::vector<std::pair<std::string_view, const MapInfo *>> modules;
+    for (auto &symbol: symbols) {
+        symbol.address = 0;
+        if (std::find_if(modules.begin(), modules.end(), [&](auto &m) {
+                return m.first == symbol.module;
+            }) == modules.end()) {
+            modules.emplace_back(symbol.module, nullptr);
+        }
+    }
+    for (auto &map: remote_info) {
+        if (map.offset != 0) continue;
+        for (auto &[suffix, found]: modules) {
+            if (found == nullptr && map.path.ends_with(suffix)) found = &map;
+        }
+    }
+
+    bool all_found = true;
+    std::vector<SandHook::ElfImg::SymbolQuery> queries;
+    for (auto &[suffix, map]: modules) {
+        if (map == nullptr) {
+            LOGE("failed to find remote base for module %s", suffix.data());
+            all_found = false;
+            continue;
+        }
+        SandHook::ElfImg img(map->path, reinterpret_cast<void *>(map->start));
+        if (!img.isValid()) {
+            LOGE("failed to parse %s", map->path.c_str());
+            all_found = false;
+            continue;
+        }
+        queries.clear();
+        for (auto &symbol: symbols) {
+            if (symbol.module == suffix) queries.emplace_back(symbol.name);
+        }
+        img.resolve(queries);
+        auto query = queries.begin();
+        for (auto &symbol: symbols) {
+            if (symbol.module != suffix) continue;
+            symbol.address = (query++)->address;
+            LOGD("sym %s in %s: %p", symbol.name.data(), map->path.c_str(),
+                 (void *) symbol.address);
+            if (symbol.address == 0) all_found = false;
+        }
+    }
+    return all_found;
+}
+
 void align_stack(struct user_regs_struct &regs, long preserve) {
     regs.REG_SP = (regs.REG_SP - preserve) & ~0xf;
 }
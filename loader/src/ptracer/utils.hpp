@@ -1,7 +1,10 @@
 #pragma once
 #include <sys/ptrace.h>
 
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 struct MapInfo {
     /// \brief The start address of the memory region.
@@ -55,6 +58,10 @@ ssize_t write_proc(int pid, uintptr_t remote_addr, const void *buf, size_t len);
 
 ssize_t read_proc(int pid, uintptr_t remote_addr, void *buf, size_t len);
 
+/// \brief Writes through /proc/pid/mem, which unlike #write_proc also works on read-only
+/// mappings such as code of the tracee.
+bool write_proc_text(int pid, uintptr_t remote_addr, const void *buf, size_t len);
+
 bool get_regs(int pid, struct user_regs_struct &regs);
 
 bool set_regs(int pid, struct user_regs_struct &regs);
@@ -66,6 +73,19 @@ void *find_module_base(std::vector<MapInfo> &info, std::string_view suffix);
 void *find_func_addr(std::vector<MapInfo> &local_info, std::vector<MapInfo> &remote_info,
                      std::string_view module, std::string_view func);
 
+struct RemoteSymbol {
+    /// \brief Suffix of the path of the library defining the symbol.
+    std::string_view module;
+    std::string_view name;
+    /// \brief Address of the symbol in the remote process, 0 if not found.
+    uintptr_t address = 0;
+};
+
+/// \brief Resolves symbols of libraries mapped in a remote process from their files, parsing
+/// each library once. Bases are taken from a single pass over \p remote_info.
+/// \return Whether all symbols were found.
+bool resolve_remote_symbols(std::vector<MapInfo> &remote_info, std::span<RemoteSymbol> symbols);
+
 void align_stack(struct user_regs_struct &regs, long preserve = 0);
 
 uintptr_t push_string(int pid, struct user_regs_struct &regs, const char *str);
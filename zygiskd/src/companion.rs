@@ -1,11 +1,11 @@
 use crate::dl;
-use crate::utils::{UnixStreamExt, check_unix_socket};
+use crate::utils::UnixStreamExt;
 use anyhow::Result;
 use passfd::FdPassingExt;
 use rustix::fs::fstat;
 use std::ffi::c_void;
 use std::os::fd::{AsRawFd, FromRawFd, RawFd};
-use std::os::unix::net::UnixStream;
+use std::os::unix::net::{UnixListener, UnixStream};
 use std::thread;
 
 type ZygiskCompanionEntryFn = unsafe extern "C" fn(i32);
@@ -15,6 +15,8 @@ pub fn entry(fd: i32) {
     let mut stream = unsafe { UnixStream::from_raw_fd(fd) };
     let name = stream.read_string().expect("read name");
     let library = stream.recv_fd().expect("receive library fd");
+    let listener = stream.recv_fd().expect("receive listener fd");
+    let listener = unsafe { UnixListener::from_raw_fd(listener) };
     let entry = load_module(library).expect("load module");
     unsafe { libc::close(library) };
 
@@ -32,32 +34,62 @@ pub fn entry(fd: i32) {
     };
 
     loop {
-        if !check_unix_socket(&stream, true) {
+        let mut fds = [
+            libc::pollfd {
+                fd: stream.as_raw_fd(),
+                events: libc::POLLIN,
+                revents: 0,
+            },
+            libc::pollfd {
+                fd: listener.as_raw_fd(),
+                events: libc::POLLIN,
+                revents: 0,
+            },
+        ];
+        if unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, -1) } < 0 {
+            continue;
+        }
+        if fds[0].revents & !libc::POLLIN != 0 {
             log::info!("Something bad happened in zygiskd, terminate companion");
             std::process::exit(0);
         }
-        let fd = stream.recv_fd().expect("recv fd");
-        log::trace!("New companion request from module `{name}` fd=`{fd}`");
-        let mut stream = unsafe { UnixStream::from_raw_fd(fd) };
-        stream.write_u8(1).expect("reply success");
-        thread::spawn(move || {
-            let st0 = fstat(&stream).expect("failed to stat stream");
-            unsafe {
-                entry(stream.as_raw_fd());
+        // Requests forwarded by zygiskd
+        if fds[0].revents & libc::POLLIN != 0 {
+            let fd = stream.recv_fd().expect("recv fd");
+            log::trace!("New companion request from module `{name}` fd=`{fd}`");
+            serve(entry, unsafe { UnixStream::from_raw_fd(fd) });
+        }
+        // Clients connecting directly
+        if fds[1].revents & libc::POLLIN != 0 {
+            if let Ok((client, _)) = listener.accept() {
+                log::trace!("New direct companion request from module `{name}`");
+                serve(entry, client);
             }
-            // Only close client if it is the same file so we don't
-            // accidentally close a re-used file descriptor.
-            // This check is required because the module companion
-            // handler could've closed the file descriptor already.
-            if let Ok(st1) = fstat(&stream) {
-                if st0.st_dev != st1.st_dev || st0.st_ino != st1.st_ino {
-                    std::mem::forget(stream);
-                }
-            } else {
+        }
+    }
+}
+
+fn serve(entry: ZygiskCompanionEntryFn, mut stream: UnixStream) {
+    if stream.write_u8(1).is_err() {
+        return;
+    }
+    thread::spawn(move || {
+        let st0 = fstat(&stream).expect("failed to stat stream");
+        unsafe {
+            entry(stream.as_raw_fd());
+        }
+        // Only close client if it is the same file so we don't
+        // accidentally close a re-used file descriptor.
+        // This check is required because the module companion
+        // handler could've closed the file descriptor already.
+        if let Ok(st1) = fstat(&stream) {
+            if st0.st_dev != st1.st_dev || st0.st_ino != st1.st_ino {
                 std::mem::forget(stream);
             }
-        });
-    }
+        } else {
+            std::mem::forget(stream);
+        }
+    });
 }
 
 fn load_module(fd: RawFd) -> Result<Option<ZygiskCompanionEntryFn>> {
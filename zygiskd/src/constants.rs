@@ -17,6 +17,9 @@ pub const MAX_LOG_LEVEL: LevelFilter = LevelFilter::Trace;
 pub const MAX_LOG_LEVEL: LevelFilter = LevelFilter::Info;
 
 pub const PATH_MODULES_DIR: &str = "..";
+pub const PATH_LINKER_CACHE: &str = lp_select!("linker_cache32", "linker_cache64");
+pub const PATH_HOLD_MOUNT_NAMESPACES: &str = "hold_mount_namespaces";
+pub const MAX_LINKER_CACHE_SIZE: usize = 4096;
 pub const ZYGOTE_INJECTED: i32 = lp_select!(5, 4);
 pub const DAEMON_SET_INFO: i32 = lp_select!(7, 6);
 pub const DAEMON_SET_ERROR_INFO: i32 = lp_select!(9, 8);
@@ -34,9 +37,18 @@ pub enum DaemonSocketAction {
     GetModuleDir,
     ZygoteRestart,
     SystemServerStarted,
+    GetSpecializeInfo,
+    ReportModuleRelro,
+    GetFlagsTable,
+    GetLinkerCache,
+    SaveLinkerCache,
+    ReportTimings,
+    GetTimingStats,
+    SetScopedOutUids,
+    TakeSpecializeLatency,
 }
 
-#[derive(Debug, Eq, PartialEq, TryFromPrimitive)]
+#[derive(Clone, Copy, Debug, Eq, PartialEq, TryFromPrimitive)]
 #[repr(u8)]
 pub enum MountNamespace {
     Clean,
@@ -44,6 +56,14 @@ pub enum MountNamespace {
     Module,
 }
 
+#[derive(Clone, Copy, Debug, Eq, PartialEq, TryFromPrimitive)]
+#[repr(u8)]
+pub enum RelroMode {
+    None,
+    Write,
+    Use,
+}
+
 // Zygisk process flags
 bitflags! {
     #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
@@ -57,3 +77,13 @@ bitflags! {
         const IS_FIRST_PROCESS = 1 << 31;
     }
 }
+
+// Module flags declared by marker files under the module's `zygisk` directory
+bitflags! {
+    #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+    pub struct ModuleFlags: u32 {
+        const ZYGOTE_RESIDENT = 1 << 0;
+        const DEFERRED_PLT_COMMIT = 1 << 1;
+        const REUSE_COMPANION = 1 << 2;
+    }
+}
@@ -0,0 +1,270 @@
+use crate::constants::ProcessFlags;
+use crate::root_impl;
+use anyhow::{Result, bail};
+use log::{debug, warn};
+use std::ffi::CString;
+use std::fs;
+use std::os::fd::{AsRawFd, OwnedFd};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering, fence};
+use std::thread;
+
+// Layout shared with zygiskd::FlagsTable in loader/src/include/daemon.hpp.
+// zygiskd is the only writer, readers map the table read-only and validate entries with
+// their sequence number, so lookups never take a lock.
+pub const FLAGS_TABLE_MAGIC: u32 = 0x5a594746;
+const CAPACITY: usize = 2048;
+const MAX_PROBES: usize = 8;
+
+#[repr(C)]
+struct Header {
+    magic: u32,
+    capacity: u32,
+    // Bumped whenever the root implementation configuration changes, stale entries are misses
+    generation: AtomicU32,
+    daemon_pid: u32,
+    // Fds of the cached mount namespaces inside zygiskd, indexed by MountNamespace
+    mount_namespace_fds: [AtomicU32; 3],
+    // Bumped whenever a namespace is cached again, so that zygote reopens those it holds
+    mount_namespace_generation: AtomicU32,
+}
+
+#[repr(C)]
+struct Entry {
+    // Odd while the entry is being written
+    sequence: AtomicU32,
+    uid: AtomicU32,
+    flags: AtomicU32,
+    // Number of modules targeting the uid
+    modules: AtomicU32,
+    generation: AtomicU32,
+}
+
+pub struct FlagsTable {
+    memfd: OwnedFd,
+    header: &'static Header,
+    entries: &'static [Entry],
+    write_lock: Mutex<()>,
+    // Only cache while changes of the root implementation configuration are watched
+    watching: AtomicBool,
+}
+
+impl FlagsTable {
+    pub fn new() -> Result<FlagsTable> {
+        let size = size_of::<Header>() + CAPACITY * size_of::<Entry>();
+        // Named like the memfd of ART's zygote JIT cache as it stays mapped in zygote
+        let memfd = memfd::MemfdOptions::default()
+            .allow_sealing(true)
+            .create("jit-zygote-cache")?;
+        memfd.as_file().set_len(size as u64)?;
+        let mut seals = memfd::SealsHashSet::new();
+        seals.insert(memfd::FileSeal::SealShrink);
+        seals.insert(memfd::FileSeal::SealGrow);
+        memfd.add_seals(&seals)?;
+
+        let addr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                memfd.as_raw_fd(),
+                0,
+            )
+        };
+        if addr == libc::MAP_FAILED {
+            bail!(std::io::Error::last_os_error());
+        }
+        // The mapping lives as long as zygiskd, and the memfd is zero filled
+        let header = unsafe { &mut *(addr as *mut Header) };
+        header.magic = FLAGS_TABLE_MAGIC;
+        header.capacity = CAPACITY as u32;
+        header.daemon_pid = std::process::id();
+        let entries = unsafe {
+            std::slice::from_raw_parts(
+                (addr as *const u8).add(size_of::<Header>()) as *const Entry,
+                CAPACITY,
+            )
+        };
+        Ok(FlagsTable {
+            memfd: OwnedFd::from(memfd.into_file()),
+            header,
+            entries,
+            write_lock: Mutex::new(()),
+            watching: AtomicBool::new(false),
+        })
+    }
+
+    // A read-only file description, so that readers can never map the table writable
+    pub fn open_read_only(&self) -> Result<fs::File> {
+        Ok(fs::File::open(format!(
+            "/proc/self/fd/{}",
+            self.memfd.as_raw_fd()
+        ))?)
+    }
+
+    fn slots(&self, uid: u32) -> impl Iterator<Item = &Entry> {
+        let start = (uid.wrapping_mul(0x9e3779b1) >> 21) as usize;
+        (0..MAX_PROBES).map(move |i| &self.entries[(start + i) % CAPACITY])
+    }
+
+    pub fn lookup(&self, uid: u32) -> Option<(ProcessFlags, u32)> {
+        if !self.watching.load(Ordering::Acquire) {
+            return None;
+        }
+        let generation = self.header.generation.load(Ordering::Acquire);
+        for entry in self.slots(uid) {
+            let sequence = entry.sequence.load(Ordering::Acquire);
+            if sequence & 1 != 0 {
+                continue;
+            }
+            let result = (
+                entry.uid.load(Ordering::Relaxed),
+                entry.flags.load(Ordering::Relaxed),
+                entry.modules.load(Ordering::Relaxed),
+                entry.generation.load(Ordering::Relaxed),
+            );
+            fence(Ordering::Acquire);
+            if entry.sequence.load(Ordering::Relaxed) != sequence || sequence == 0 {
+                continue;
+            }
+            if result.0 == uid && result.3 == generation {
+                return Some((ProcessFlags::from_bits_retain(result.1), result.2));
+            }
+        }
+        None
+    }
+
+    // Taken before the flags to insert are computed, see insert
+    pub fn generation(&self) -> u32 {
+        self.header.generation.load(Ordering::Acquire)
+    }
+
+    // IS_FIRST_PROCESS is only ever reported once and must not be cached. Flags computed before
+    // an invalidation are dropped, an invalidation racing with the store leaves the entry stale.
+    pub fn insert(&self, uid: u32, flags: ProcessFlags, modules: u32, generation: u32) {
+        if flags.contains(ProcessFlags::IS_FIRST_PROCESS) || !self.watching.load(Ordering::Acquire)
+        {
+            return;
+        }
+        let _guard = self.write_lock.lock().unwrap();
+        if self.header.generation.load(Ordering::Acquire) != generation {
+            return;
+        }
+        // Reuse the slot of the uid, or the first stale one, or evict the first probed
+        let mut target = None;
+        for entry in self.slots(uid) {
+            let sequence = entry.sequence.load(Ordering::Relaxed);
+            if sequence != 0 && entry.uid.load(Ordering::Relaxed) == uid {
+                target = Some(entry);
+                break;
+            }
+            if target.is_none()
+                && (sequence == 0 || entry.generation.load(Ordering::Relaxed) != generation)
+            {
+                target = Some(entry);
+            }
+        }
+        let entry = target.unwrap_or_else(|| self.slots(uid).next().unwrap());
+        let sequence = entry.sequence.load(Ordering::Relaxed);
+        entry.sequence.store(sequence | 1, Ordering::Relaxed);
+        fence(Ordering::Release);
+        entry.uid.store(uid, Ordering::Relaxed);
+        entry.flags.store(flags.bits(), Ordering::Relaxed);
+        entry.modules.store(modules, Ordering::Relaxed);
+        entry.generation.store(generation, Ordering::Relaxed);
+        entry.sequence.store((sequence | 1) + 1, Ordering::Release);
+    }
+
+    pub fn invalidate(&self) {
+        let generation = self.header.generation.fetch_add(1, Ordering::AcqRel) + 1;
+        debug!("Process flags table invalidated, generation {generation}");
+    }
+
+    pub fn publish_mount_namespace(&self, namespace_type: usize, fd: i32) {
+        self.header.mount_namespace_fds[namespace_type].store(fd as u32, Ordering::Release);
+        self.header
+            .mount_namespace_generation
+            .fetch_add(1, Ordering::AcqRel);
+    }
+}
+
+// Files whose changes may change process flags or module targets, as (directory, file prefix)
+fn watched_files() -> Vec<(&'static str, &'static str)> {
+    let mut files = vec![("/data/system", "packages.list")];
+    match root_impl::get_impl() {
+        root_impl::RootImpl::APatch => files.push(("/data/adb/ap", "package_config")),
+        root_impl::RootImpl::KernelSU => files.push(("/data/adb/ksu", ".allowlist")),
+        root_impl::RootImpl::Magisk => files.push(("/data/adb", "magisk.db")),
+        _ => {}
+    }
+    files
+}
+
+// Invalidate the table from a background thread whenever a watched file changes
+pub fn watch_changes(table: &'static FlagsTable) -> Result<()> {
+    let fd = unsafe { libc::inotify_init1(libc::IN_CLOEXEC) };
+    if fd < 0 {
+        bail!(std::io::Error::last_os_error());
+    }
+    let mut watches = Vec::new();
+    for (dir, prefix) in watched_files() {
+        let path = CString::new(dir)?;
+        let mask = libc::IN_CLOSE_WRITE
+            | libc::IN_MODIFY
+            | libc::IN_MOVED_TO
+            | libc::IN_CREATE
+            | libc::IN_DELETE;
+        let wd = unsafe { libc::inotify_add_watch(fd, path.as_ptr(), mask) };
+        // Caching without being notified of every change is never safe
+        if wd < 0 {
+            let e = std::io::Error::last_os_error();
+            unsafe { libc::close(fd) };
+            bail!("failed to watch {}: {}", dir, e);
+        }
+        watches.push((wd, prefix));
+    }
+
+    table.watching.store(true, Ordering::Release);
+    thread::spawn(move || {
+        let mut buf = [0u8; 4096];
+        loop {
+            let len = unsafe { libc::read(fd, buf.as_mut_ptr() as *mut libc::c_void, buf.len()) };
+            if len <= 0 {
+                if std::io::Error::last_os_error().kind() == std::io::ErrorKind::Interrupted {
+                    continue;
+                }
+                warn!(
+                    "Stop watching root configuration: {}",
+                    std::io::Error::last_os_error()
+                );
+                // Without notifications nothing can be trusted to stay valid
+                table.watching.store(false, Ordering::Release);
+                table.invalidate();
+                return;
+            }
+            let mut invalidated = false;
+            let mut offset = 0;
+            while offset + size_of::<libc::inotify_event>() <= len as usize {
+                let event = unsafe {
+                    std::ptr::read_unaligned(buf.as_ptr().add(offset) as *const libc::inotify_event)
+                };
+                let name_start = offset + size_of::<libc::inotify_event>();
+                let name = &buf[name_start..name_start + event.len as usize];
+                let name = name.split(|&c| c == 0).next().unwrap_or_default();
+                let overflow = event.mask & libc::IN_Q_OVERFLOW != 0;
+                if !invalidated
+                    && (overflow
+                        || watches.iter().any(|(wd, prefix)| {
+                            *wd == event.wd && name.starts_with(prefix.as_bytes())
+                        }))
+                {
+                    table.invalidate();
+                    invalidated = true;
+                }
+                offset = name_start + event.len as usize;
+            }
+        }
+    });
+    Ok(())
+}
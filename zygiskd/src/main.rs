@@ -1,7 +1,10 @@
 mod companion;
 mod constants;
 mod dl;
+mod flags_table;
 mod root_impl;
+mod targets;
+mod timings;
 mod utils;
 mod zygiskd;
 
@@ -0,0 +1,114 @@
+use log::{debug, warn};
+use std::collections::HashMap;
+use std::fs;
+use std::path::Path;
+use std::sync::{LazyLock, Mutex};
+use std::time::SystemTime;
+
+const PACKAGES_LIST: &str = "/data/system/packages.list";
+const PER_USER_RANGE: u32 = 100000;
+const SYSTEM_SERVER: &str = "system_server";
+
+// Processes a module declares interest in through its `zygisk/targets` file.
+// Each line holds a package name, a uid, an app id matching all users or `system_server`.
+// Empty lines and lines starting with `#` are ignored.
+pub struct Targets {
+    packages: Vec<String>,
+    uids: Vec<u32>,
+    app_ids: Vec<u32>,
+    system_server: bool,
+}
+
+impl Targets {
+    pub fn load(path: &Path) -> Option<Targets> {
+        let content = match fs::read_to_string(path) {
+            Ok(content) => content,
+            Err(e) => {
+                if path.exists() {
+                    warn!(
+                        "Failed to read {}: {}, targeting all processes",
+                        path.display(),
+                        e
+                    );
+                }
+                return None;
+            }
+        };
+        let mut targets = Targets {
+            packages: Vec::new(),
+            uids: Vec::new(),
+            app_ids: Vec::new(),
+            system_server: false,
+        };
+        for line in content.lines().map(str::trim) {
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+            if line == SYSTEM_SERVER {
+                targets.system_server = true;
+            } else if let Ok(id) = line.parse::<u32>() {
+                if id < PER_USER_RANGE {
+                    targets.app_ids.push(id);
+                } else {
+                    targets.uids.push(id);
+                }
+            } else {
+                targets.packages.push(line.to_string());
+            }
+        }
+        Some(targets)
+    }
+
+    pub fn matches(&self, uid: i32, is_system_server: bool) -> bool {
+        if is_system_server {
+            return self.system_server;
+        }
+        let uid = uid as u32;
+        let app_id = uid % PER_USER_RANGE;
+        self.uids.contains(&uid)
+            || self.app_ids.contains(&app_id)
+            || (!self.packages.is_empty()
+                && with_packages(|app_ids| {
+                    self.packages
+                        .iter()
+                        .any(|pkg| app_ids.get(pkg) == Some(&app_id))
+                }))
+    }
+}
+
+struct PackageList {
+    modified: Option<SystemTime>,
+    app_ids: HashMap<String, u32>,
+}
+
+static PACKAGES: LazyLock<Mutex<PackageList>> = LazyLock::new(|| {
+    Mutex::new(PackageList {
+        modified: None,
+        app_ids: HashMap::new(),
+    })
+});
+
+// Packages are resolved through packages.list, reloaded whenever it is rewritten
+fn with_packages<R>(f: impl FnOnce(&HashMap<String, u32>) -> R) -> R {
+    let mut packages = PACKAGES.lock().unwrap();
+    let modified = fs::metadata(PACKAGES_LIST).and_then(|m| m.modified()).ok();
+    if modified.is_some() && modified != packages.modified {
+        match fs::read_to_string(PACKAGES_LIST) {
+            Ok(content) => {
+                packages.app_ids = content
+                    .lines()
+                    .filter_map(|line| {
+                        let mut fields = line.split_whitespace();
+                        let name = fields.next()?;
+                        let uid = fields.next()?.parse::<u32>().ok()?;
+                        Some((name.to_string(), uid % PER_USER_RANGE))
+                    })
+                    .collect();
+                packages.modified = modified;
+                debug!("Loaded {} packages", packages.app_ids.len());
+            }
+            Err(e) => warn!("Failed to read {}: {}", PACKAGES_LIST, e),
+        }
+    }
+    f(&packages.app_ids)
+}
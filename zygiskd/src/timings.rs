@@ -0,0 +1,194 @@
+use std::collections::{BTreeMap, HashMap};
+use std::fmt::Write;
+use std::sync::{LazyLock, Mutex};
+
+// Phases of a specialization, matching timing::Phase in loader/src/injector/timing.hpp
+const PHASE_NAMES: [&str; 12] = [
+    "fork_pre",
+    "GetProcessFlags",
+    "GetSpecializeInfo",
+    "update_mount_namespace",
+    "DlopenMem",
+    "onLoad",
+    "pre specialize",
+    "sanitize_fds",
+    "post specialize",
+    "run_modules_post",
+    "clean_trace",
+    "specialize",
+];
+const NO_MODULE: u32 = u32::MAX;
+const PHASE_SPECIALIZE: u32 = 11;
+// Latencies of apps nobody asked for are dropped beyond this
+const MAX_LATENCIES: usize = 1024;
+// Bucket i counts samples of less than 2^(i + 1) microseconds, the last one everything slower
+const BUCKETS: usize = 24;
+// Each sample is the phase, the module index and the duration in microseconds as u32
+pub const SAMPLE_SIZE: usize = 12;
+pub const MAX_SAMPLES: usize = 256;
+// Each module sample is the module index, the total time of its samples, its mapped size in KiB,
+// the PLT hooks it registered and committed and whether it was unloaded, all as u32
+pub const MODULE_SAMPLE_SIZE: usize = 24;
+pub const MAX_MODULE_SAMPLES: usize = 64;
+
+#[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum ProcessClass {
+    App,
+    SystemServer,
+}
+
+#[derive(Default)]
+struct Histogram {
+    count: u64,
+    total: u64,
+    max: u32,
+    buckets: [u64; BUCKETS],
+}
+
+impl Histogram {
+    fn add(&mut self, micros: u32) {
+        let bucket = (u32::BITS - (micros >> 1).leading_zeros()) as usize;
+        self.buckets[bucket.min(BUCKETS - 1)] += 1;
+        self.count += 1;
+        self.total += micros as u64;
+        self.max = self.max.max(micros);
+    }
+
+    // Upper bound of the bucket holding the given fraction of samples
+    fn percentile(&self, fraction: f64) -> u64 {
+        let target = (self.count as f64 * fraction).ceil() as u64;
+        let mut seen = 0;
+        for (i, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= target {
+                return 1 << (i + 1);
+            }
+        }
+        1 << BUCKETS
+    }
+}
+
+// Costs of a module summed over all processes it was loaded in
+#[derive(Default)]
+struct ModuleCosts {
+    time: Histogram,
+    mapped_kb: u64,
+    max_mapped_kb: u32,
+    plt_hooks_registered: u64,
+    plt_hooks_committed: u64,
+    unloaded: u64,
+}
+
+static HISTOGRAMS: LazyLock<Mutex<BTreeMap<(ProcessClass, u32, u32), Histogram>>> =
+    LazyLock::new(|| Mutex::new(BTreeMap::new()));
+static MODULE_COSTS: LazyLock<Mutex<BTreeMap<(ProcessClass, u32), ModuleCosts>>> =
+    LazyLock::new(|| Mutex::new(BTreeMap::new()));
+// Last specialize latency of each app uid, taken by `zygisk-ctl.sh bench`
+static LATENCIES: LazyLock<Mutex<HashMap<u32, u32>>> = LazyLock::new(|| Mutex::new(HashMap::new()));
+
+fn fields<const N: usize>(sample: &[u8]) -> [u32; N] {
+    std::array::from_fn(|i| u32::from_ne_bytes(sample[i * 4..i * 4 + 4].try_into().unwrap()))
+}
+
+pub fn record(class: ProcessClass, uid: u32, samples: &[u8], modules: &[u8]) {
+    let mut histograms = HISTOGRAMS.lock().unwrap();
+    for sample in samples.chunks_exact(SAMPLE_SIZE) {
+        let [phase, module, micros] = fields(sample);
+        if phase as usize >= PHASE_NAMES.len() {
+            continue;
+        }
+        if phase == PHASE_SPECIALIZE && class == ProcessClass::App {
+            let mut latencies = LATENCIES.lock().unwrap();
+            if latencies.len() >= MAX_LATENCIES {
+                latencies.clear();
+            }
+            latencies.insert(uid, micros);
+        }
+        histograms
+            .entry((class, phase, module))
+            .or_default()
+            .add(micros);
+    }
+    drop(histograms);
+
+    let mut costs = MODULE_COSTS.lock().unwrap();
+    for sample in modules.chunks_exact(MODULE_SAMPLE_SIZE) {
+        let [module, micros, mapped_kb, registered, committed, unloaded] = fields(sample);
+        let cost = costs.entry((class, module)).or_default();
+        cost.time.add(micros);
+        cost.mapped_kb += mapped_kb as u64;
+        cost.max_mapped_kb = cost.max_mapped_kb.max(mapped_kb);
+        cost.plt_hooks_registered += registered as u64;
+        cost.plt_hooks_committed += committed as u64;
+        cost.unloaded += (unloaded != 0) as u64;
+    }
+}
+
+pub fn take_specialize_latency(uid: u32) -> u32 {
+    LATENCIES.lock().unwrap().remove(&uid).unwrap_or(0)
+}
+
+fn class_title(class: ProcessClass) -> &'static str {
+    match class {
+        ProcessClass::App => "apps",
+        ProcessClass::SystemServer => "system_server",
+    }
+}
+
+// Human readable summary, module_name resolves module indices
+pub fn report(module_name: impl Fn(u32) -> Option<String>) -> String {
+    let histograms = HISTOGRAMS.lock().unwrap();
+    let mut out = String::new();
+    let mut class = None;
+    for ((process_class, phase, module), histogram) in histograms.iter() {
+        if class != Some(*process_class) {
+            class = Some(*process_class);
+            let _ = writeln!(out, "{}:", class_title(*process_class));
+        }
+        let mut name = PHASE_NAMES[*phase as usize].to_string();
+        if *module != NO_MODULE {
+            let module = module_name(*module).unwrap_or_else(|| format!("#{module}"));
+            let _ = write!(name, " [{module}]");
+        }
+        let _ = writeln!(
+            out,
+            "  {name}: {} samples, mean {} us, p50 < {} us, p90 < {} us, p99 < {} us, max {} us",
+            histogram.count,
+            histogram.total / histogram.count,
+            histogram.percentile(0.5),
+            histogram.percentile(0.9),
+            histogram.percentile(0.99),
+            histogram.max
+        );
+    }
+    drop(histograms);
+
+    let costs = MODULE_COSTS.lock().unwrap();
+    let mut class = None;
+    for ((process_class, module), cost) in costs.iter() {
+        if class != Some(*process_class) {
+            class = Some(*process_class);
+            let _ = writeln!(out, "modules in {}:", class_title(*process_class));
+        }
+        let name = module_name(*module).unwrap_or_else(|| format!("#{module}"));
+        let count = cost.time.count;
+        let _ = writeln!(
+            out,
+            "  {name}: {count} processes, mean {} us, p90 < {} us, max {} us, \
+             mapped mean {} KiB max {} KiB, plt hooks {} registered {} committed, \
+             unloaded {}/{count}",
+            cost.time.total / count,
+            cost.time.percentile(0.9),
+            cost.time.max,
+            cost.mapped_kb / count,
+            cost.max_mapped_kb,
+            cost.plt_hooks_registered,
+            cost.plt_hooks_committed,
+            cost.unloaded
+        );
+    }
+    if out.is_empty() {
+        out.push_str("No specialization timings recorded yet\n");
+    }
+    out
+}
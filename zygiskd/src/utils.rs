@@ -9,7 +9,7 @@ use rustix::path::Arg;
 use rustix::thread::gettid;
 use std::ffi::{CStr, CString, c_char, c_void};
 use std::io::Error;
-use std::os::fd::{AsFd, AsRawFd};
+use std::os::fd::{AsFd, AsRawFd, RawFd};
 use std::os::unix::net::UnixListener;
 use std::process::Command;
 use std::sync::OnceLock;
@@ -296,8 +296,12 @@ pub trait UnixStreamExt {
     fn write_u32(&mut self, value: u32) -> Result<()>;
     fn write_usize(&mut self, value: usize) -> Result<()>;
     fn write_string(&mut self, value: &str) -> Result<()>;
+    fn send_fds(&mut self, fds: &[RawFd]) -> Result<()>;
 }
 
+// Most fds the kernel accepts in one SCM_RIGHTS message, larger sets are split
+pub const SCM_MAX_FD: usize = 253;
+
 impl UnixStreamExt for UnixStream {
     fn read_u8(&mut self) -> Result<u8> {
         let mut buf = [0u8; 1];
@@ -344,6 +348,41 @@ impl UnixStreamExt for UnixStream {
         self.write_all(value.as_bytes())?;
         Ok(())
     }
+
+    // Like passfd, every message carries a dummy int next to its fds
+    fn send_fds(&mut self, fds: &[RawFd]) -> Result<()> {
+        for chunk in fds.chunks(SCM_MAX_FD) {
+            let mut dummy: libc::c_int = 0;
+            let mut iov = libc::iovec {
+                iov_base: &mut dummy as *mut libc::c_int as *mut c_void,
+                iov_len: size_of::<libc::c_int>(),
+            };
+            let data_len = (chunk.len() * size_of::<RawFd>()) as u32;
+            let space = unsafe { libc::CMSG_SPACE(data_len) } as usize;
+            // u64 keeps the control buffer aligned for cmsghdr
+            let mut control = vec![0u64; space.div_ceil(size_of::<u64>())];
+            let mut msg: libc::msghdr = unsafe { std::mem::zeroed() };
+            msg.msg_iov = &mut iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.as_mut_ptr() as *mut c_void;
+            msg.msg_controllen = space as _;
+            unsafe {
+                let cmsg = libc::CMSG_FIRSTHDR(&msg);
+                (*cmsg).cmsg_level = libc::SOL_SOCKET;
+                (*cmsg).cmsg_type = libc::SCM_RIGHTS;
+                (*cmsg).cmsg_len = libc::CMSG_LEN(data_len) as _;
+                std::ptr::copy_nonoverlapping(
+                    chunk.as_ptr(),
+                    libc::CMSG_DATA(cmsg) as *mut RawFd,
+                    chunk.len(),
+                );
+                if libc::sendmsg(self.as_raw_fd(), &msg, 0) < 0 {
+                    bail!(Error::last_os_error());
+                }
+            }
+        }
+        Ok(())
+    }
 }
 
 pub fn unix_listener_from_path(path: &str) -> Result<UnixListener> {
@@ -1,12 +1,15 @@
-use crate::constants::{DaemonSocketAction, MountNamespace, ProcessFlags};
+use crate::constants::{DaemonSocketAction, ModuleFlags, MountNamespace, ProcessFlags, RelroMode};
+use crate::flags_table::FlagsTable;
+use crate::targets::Targets;
+use crate::timings::{self, ProcessClass};
 use crate::utils::{LateInit, UnixStreamExt, check_unix_socket, save_mount_namespace};
-use crate::{constants, lp_select, root_impl, utils};
+use crate::{constants, flags_table, lp_select, root_impl, utils};
 use anyhow::{Result, bail};
 use log::{debug, error, info, trace, warn};
 use passfd::FdPassingExt;
 use rustix::fs::{FdFlags, fcntl_setfd};
 use std::fs;
-use std::io::Error;
+use std::io::{Error, Read, Write};
 use std::ops::Deref;
 use std::os::fd::{AsFd, OwnedFd, RawFd};
 use std::os::unix::process::CommandExt;
@@ -14,17 +17,37 @@ use std::os::unix::{
     net::{UnixListener, UnixStream},
     prelude::AsRawFd,
 };
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 use std::process::{Command, exit};
 use std::sync::{Arc, Mutex};
 use std::thread;
+use std::time::{Duration, Instant};
 
 struct Module {
     name: String,
+    flags: ModuleFlags,
     lib_fd: OwnedFd,
     companion: Mutex<Option<UnixStream>>,
+    relro: Mutex<Relro>,
+    // None if the module targets all processes
+    targets: Option<Targets>,
 }
 
+// RELRO section of a module relocated at the address zygote reserved for it,
+// written by the first process loading the module and shared by all later ones
+enum Relro {
+    // Not written yet, with the number of failed attempts
+    Missing(u8),
+    // Handed to a process to write at the given time, waiting for its report
+    Writing(memfd::Memfd, u8, Instant),
+    Ready(memfd::Memfd),
+}
+
+const MAX_RELRO_ATTEMPTS: u8 = 3;
+// A writer that did not report by then died or never loaded the module, which counts as a
+// failed attempt. Writing takes milliseconds, a report this late is not expected anymore.
+const RELRO_WRITE_TIMEOUT: Duration = Duration::from_secs(30);
+
 struct Context {
     modules: Vec<Module>,
 }
@@ -33,6 +56,9 @@ static TMP_PATH: LateInit<String> = LateInit::new();
 static CONTROLLER_SOCKET: LateInit<String> = LateInit::new();
 static PATH_CP_NAME: LateInit<String> = LateInit::new();
 static IS_FIRST_PROCESS: LateInit<bool> = LateInit::new();
+static FLAGS_TABLE: LateInit<FlagsTable> = LateInit::new();
+// Uids no module is loaded into, set by `zygisk-ctl.sh bench`
+static SCOPED_OUT_UIDS: Mutex<Vec<u32>> = Mutex::new(Vec::new());
 
 pub fn main() -> Result<()> {
     info!("Welcome to NeoZygisk ({}) !", constants::ZKSU_VERSION);
@@ -83,21 +109,52 @@ pub fn main() -> Result<()> {
             .expect("failed to send info");
     }
 
+    match FlagsTable::new() {
+        Ok(table) => {
+            FLAGS_TABLE.init(table);
+            if let Err(e) = flags_table::watch_changes(&FLAGS_TABLE) {
+                warn!("Process flags will not be cached: {}", e);
+            }
+        }
+        Err(e) => warn!("Failed to create process flags table: {}", e),
+    }
+
     let context = Context { modules };
     let context = Arc::new(context);
     let listener = create_daemon_socket()?;
     for stream in listener.incoming() {
         let mut stream = stream?;
         let context = Arc::clone(&context);
-        let action = stream.read_u8()?;
-        let action = DaemonSocketAction::try_from(action)?;
+        let action = match read_action(&mut stream) {
+            Ok(action) => action,
+            Err(e) => {
+                warn!("Failed to read daemon action: {}", e);
+                continue;
+            }
+        };
         trace!("New daemon action {:?}", action);
         match action {
             DaemonSocketAction::CacheMountNamespace => {
-                let pid = stream.read_u32()? as i32;
-                save_mount_namespace(pid, MountNamespace::Clean)?;
-                save_mount_namespace(pid, MountNamespace::Root)?;
-                save_mount_namespace(pid, MountNamespace::Module)?;
+                let pid = match stream.read_u32() {
+                    Ok(pid) => pid as i32,
+                    Err(e) => {
+                        warn!("Failed to read zygote pid: {}", e);
+                        continue;
+                    }
+                };
+                // Zygote only holds the namespaces when the user opted in
+                let publish = FLAGS_TABLE.initiated()
+                    && Path::new(constants::PATH_HOLD_MOUNT_NAMESPACES).exists();
+                for namespace_type in [
+                    MountNamespace::Clean,
+                    MountNamespace::Root,
+                    MountNamespace::Module,
+                ] {
+                    let fd = save_mount_namespace(pid, namespace_type)?;
+                    if publish {
+                        FLAGS_TABLE.publish_mount_namespace(namespace_type as usize, fd);
+                    }
+                }
             }
             DaemonSocketAction::PingHeartbeat => {
                 let value = constants::ZYGOTE_INJECTED;
@@ -105,9 +162,13 @@ pub fn main() -> Result<()> {
             }
             DaemonSocketAction::ZygoteRestart => {
                 info!("Zygote restarted, clean up companions");
-                for module in &context.modules {
+                for (index, module) in context.modules.iter().enumerate() {
                     let mut companion = module.companion.lock().unwrap();
-                    companion.take();
+                    if companion.take().is_some() {
+                        let _ = fs::remove_file(companion_socket_path(index));
+                    }
+                    // The new zygote reserves different addresses
+                    *module.relro.lock().unwrap() = Relro::Missing(0);
                 }
             }
             DaemonSocketAction::SystemServerStarted => {
@@ -127,6 +188,11 @@ pub fn main() -> Result<()> {
     Ok(())
 }
 
+fn read_action(stream: &mut UnixStream) -> Result<DaemonSocketAction> {
+    let action = stream.read_u8()?;
+    Ok(DaemonSocketAction::try_from(action)?)
+}
+
 fn get_arch() -> Result<&'static str> {
     let system_arch = utils::get_property("ro.product.cpu.abi")?;
     if system_arch.contains("arm") {
@@ -155,7 +221,25 @@ fn load_modules(arch: &str) -> Result<Vec<Module>> {
         if !so_path.exists() || disabled.exists() {
             continue;
         }
-        info!("Loading module `{name}`...");
+        let mut flags = ModuleFlags::empty();
+        if entry.path().join("zygisk/zygote_resident").exists() {
+            flags |= ModuleFlags::ZYGOTE_RESIDENT;
+        }
+        if entry.path().join("zygisk/defer_plt_commit").exists() {
+            flags |= ModuleFlags::DEFERRED_PLT_COMMIT;
+        }
+        if entry.path().join("zygisk/reuse_companion").exists() {
+            flags |= ModuleFlags::REUSE_COMPANION;
+        }
+        let targets = Targets::load(&entry.path().join("zygisk/targets"));
+        info!(
+            "Loading module `{name}` ({flags:?}, targeting {})...",
+            if targets.is_some() {
+                "some processes"
+            } else {
+                "all processes"
+            }
+        );
         let lib_fd = match create_library_fd(&so_path) {
             Ok(fd) => fd,
             Err(e) => {
@@ -164,10 +248,14 @@ fn load_modules(arch: &str) -> Result<Vec<Module>> {
             }
         };
         let companion = Mutex::new(None);
+        let relro = Mutex::new(Relro::Missing(0));
         let module = Module {
             name,
+            flags,
             lib_fd,
             companion,
+            relro,
+            targets,
         };
         modules.push(module);
     }
@@ -183,14 +271,19 @@ fn create_library_fd(so_path: &PathBuf) -> Result<OwnedFd> {
     let mut writer = memfd.as_file();
     std::io::copy(&mut reader, &mut writer)?;
 
+    seal_memfd(&memfd)?;
+
+    Ok(OwnedFd::from(memfd.into_file()))
+}
+
+fn seal_memfd(memfd: &memfd::Memfd) -> Result<()> {
     let mut seals = memfd::SealsHashSet::new();
     seals.insert(memfd::FileSeal::SealShrink);
     seals.insert(memfd::FileSeal::SealGrow);
     seals.insert(memfd::FileSeal::SealWrite);
     seals.insert(memfd::FileSeal::SealSeal);
     memfd.add_seals(&seals)?;
-
-    Ok(OwnedFd::from(memfd.into_file()))
+    Ok(())
 }
 
 fn create_daemon_socket() -> Result<UnixListener> {
@@ -199,8 +292,21 @@ fn create_daemon_socket() -> Result<UnixListener> {
     Ok(listener)
 }
 
-fn spawn_companion(name: &str, lib_fd: RawFd) -> Result<Option<UnixStream>> {
+// Clients connect to the companion of a module directly once it is running,
+// requests through zygiskd remain the fallback and start it
+fn companion_socket_path(index: usize) -> String {
+    format!(
+        "{}/{}-{}.sock",
+        TMP_PATH.deref(),
+        lp_select!("cp32", "cp64"),
+        index
+    )
+}
+
+fn spawn_companion(name: &str, lib_fd: RawFd, index: usize) -> Result<Option<UnixStream>> {
     let (mut daemon, companion) = UnixStream::pair()?;
+    let path = companion_socket_path(index);
+    let listener = utils::unix_listener_from_path(&path)?;
 
     // FIXME: avoid getting self path from arg0
     let process = std::env::args().next().unwrap();
@@ -214,17 +320,24 @@ fn spawn_companion(name: &str, lib_fd: RawFd) -> Result<Option<UnixStream>> {
             drop(companion);
             let mut status: libc::c_int = 0;
             libc::waitpid(pid, &mut status, 0);
-            if libc::WIFEXITED(status) && libc::WEXITSTATUS(status) == 0 {
-                daemon.write_string(name)?;
-                daemon.send_fd(lib_fd)?;
-                return match daemon.read_u8()? {
-                    0 => Ok(None),
-                    1 => Ok(Some(daemon)),
-                    _ => bail!("Invalid companion response"),
-                };
+            let result = if libc::WIFEXITED(status) && libc::WEXITSTATUS(status) == 0 {
+                (|| {
+                    daemon.write_string(name)?;
+                    daemon.send_fd(lib_fd)?;
+                    daemon.send_fd(listener.as_raw_fd())?;
+                    match daemon.read_u8()? {
+                        0 => Ok(None),
+                        1 => Ok(Some(daemon)),
+                        _ => bail!("Invalid companion response"),
+                    }
+                })()
             } else {
-                bail!("exited with status {}", status);
+                Err(anyhow::anyhow!("exited with status {}", status))
+            };
+            if !matches!(result, Ok(Some(_))) {
+                let _ = fs::remove_file(&path);
             }
+            return result;
         } else {
             // Remove FD_CLOEXEC flag
             fcntl_setfd(companion.as_fd(), FdFlags::empty())?;
@@ -239,6 +352,142 @@ fn spawn_companion(name: &str, lib_fd: RawFd) -> Result<Option<UnixStream>> {
     exit(0)
 }
 
+fn get_process_flags(uid: i32) -> ProcessFlags {
+    let mut flags = ProcessFlags::empty();
+    if !IS_FIRST_PROCESS.initiated() {
+        flags |= ProcessFlags::IS_FIRST_PROCESS;
+        if root_impl::uid_is_systemui(uid) {
+            trace!("Uid {} is systemui", uid,);
+        } else {
+            trace!("Uid {} is the first app process", uid,);
+        }
+        IS_FIRST_PROCESS.init(false);
+    } else if let Some((cached, _)) = FLAGS_TABLE
+        .initiated()
+        .then(|| FLAGS_TABLE.lookup(uid as u32))
+        .flatten()
+    {
+        trace!("Uid {} has cached flags {:?}", uid, cached);
+        return cached;
+    } else if root_impl::uid_is_manager(uid) {
+        flags |= ProcessFlags::PROCESS_IS_MANAGER;
+        trace!("Uid {} is manager", uid,);
+    } else {
+        if root_impl::uid_granted_root(uid) {
+            flags |= ProcessFlags::PROCESS_GRANTED_ROOT;
+        }
+        if root_impl::uid_should_umount(uid) {
+            flags |= ProcessFlags::PROCESS_ON_DENYLIST;
+        }
+    }
+    match root_impl::get_impl() {
+        root_impl::RootImpl::APatch => flags |= ProcessFlags::PROCESS_ROOT_IS_APATCH,
+        root_impl::RootImpl::KernelSU => flags |= ProcessFlags::PROCESS_ROOT_IS_KSU,
+        root_impl::RootImpl::Magisk => flags |= ProcessFlags::PROCESS_ROOT_IS_MAGISK,
+        _ => panic!("wrong root impl: {:?}", root_impl::get_impl()),
+    }
+    trace!(
+        "Uid {} granted root: {}",
+        uid,
+        flags.contains(ProcessFlags::PROCESS_GRANTED_ROOT)
+    );
+    trace!(
+        "Uid {} on denylist: {}",
+        uid,
+        flags.contains(ProcessFlags::PROCESS_ON_DENYLIST)
+    );
+    flags
+}
+
+// Modules with their indexes, all of them if there is no target process
+fn target_modules(context: &Context, target: Option<(i32, bool)>) -> Vec<(usize, &Module)> {
+    if let Some((uid, false)) = target {
+        if SCOPED_OUT_UIDS.lock().unwrap().contains(&(uid as u32)) {
+            return Vec::new();
+        }
+    }
+    context
+        .modules
+        .iter()
+        .enumerate()
+        .filter(|(_, module)| match (target, &module.targets) {
+            (Some((uid, is_system_server)), Some(targets)) => {
+                targets.matches(uid, is_system_server)
+            }
+            _ => true,
+        })
+        .collect()
+}
+
+// All module entries are written as one blob, followed by the fds of the modules and then
+// those of their RELRO sections in as few messages as possible:
+// count, then per module index, flags, RELRO mode and name
+fn write_modules(
+    stream: &mut UnixStream,
+    modules: Vec<(usize, &Module)>,
+    share_relro: bool,
+) -> Result<()> {
+    let mut blob = Vec::new();
+    let mut fds = Vec::with_capacity(modules.len());
+    // Duplicated, as RELRO memfds may be replaced by other requests before being sent
+    let mut relro_fds = Vec::new();
+    blob.extend_from_slice(&modules.len().to_ne_bytes());
+    for (index, module) in modules {
+        // Resident modules are never loaded by app processes
+        let (mode, relro_fd) =
+            if share_relro && !module.flags.contains(ModuleFlags::ZYGOTE_RESIDENT) {
+                module_relro(module)?
+            } else {
+                (RelroMode::None, None)
+            };
+        blob.extend_from_slice(&index.to_ne_bytes());
+        blob.extend_from_slice(&module.flags.bits().to_ne_bytes());
+        blob.push(mode as u8);
+        blob.extend_from_slice(&module.name.len().to_ne_bytes());
+        blob.extend_from_slice(module.name.as_bytes());
+        fds.push(module.lib_fd.as_raw_fd());
+        relro_fds.extend(relro_fd);
+    }
+    stream.write_usize(blob.len())?;
+    stream.write_all(&blob)?;
+    fds.extend(relro_fds.iter().map(|fd| fd.as_raw_fd()));
+    if !fds.is_empty() {
+        stream.send_fds(&fds)?;
+    }
+    Ok(())
+}
+
+fn module_relro(module: &Module) -> Result<(RelroMode, Option<OwnedFd>)> {
+    let mut relro = module.relro.lock().unwrap();
+    if let Relro::Writing(_, attempts, since) = *relro {
+        if since.elapsed() >= RELRO_WRITE_TIMEOUT {
+            warn!("RELRO of `{}` was not reported in time", module.name);
+            *relro = Relro::Missing(attempts + 1);
+        }
+    }
+    if let Relro::Missing(attempts) = *relro {
+        if attempts < MAX_RELRO_ATTEMPTS {
+            // Named like the memfd of ART's JIT code cache as it stays mapped in apps
+            let opts = memfd::MemfdOptions::default().allow_sealing(true);
+            match opts.create("jit-cache") {
+                Ok(memfd) => {
+                    let fd = memfd.as_file().as_fd().try_clone_to_owned()?;
+                    *relro = Relro::Writing(memfd, attempts, Instant::now());
+                    return Ok((RelroMode::Write, Some(fd)));
+                }
+                Err(e) => warn!("Failed to create RELRO memfd for `{}`: {}", module.name, e),
+            }
+        }
+    }
+    match &*relro {
+        Relro::Ready(memfd) => Ok((
+            RelroMode::Use,
+            Some(memfd.as_file().as_fd().try_clone_to_owned()?),
+        )),
+        _ => Ok((RelroMode::None, None)),
+    }
+}
+
 fn handle_daemon_action(
     action: DaemonSocketAction,
     mut stream: UnixStream,
@@ -247,42 +496,7 @@ fn handle_daemon_action(
     match action {
         DaemonSocketAction::GetProcessFlags => {
             let uid = stream.read_u32()? as i32;
-            let mut flags = ProcessFlags::empty();
-            if !IS_FIRST_PROCESS.initiated() {
-                flags |= ProcessFlags::IS_FIRST_PROCESS;
-                if root_impl::uid_is_systemui(uid) {
-                    trace!("Uid {} is systemui", uid,);
-                } else {
-                    trace!("Uid {} is the first app process", uid,);
-                }
-                IS_FIRST_PROCESS.init(false);
-            } else if root_impl::uid_is_manager(uid) {
-                flags |= ProcessFlags::PROCESS_IS_MANAGER;
-                trace!("Uid {} is manager", uid,);
-            } else {
-                if root_impl::uid_granted_root(uid) {
-                    flags |= ProcessFlags::PROCESS_GRANTED_ROOT;
-                }
-                if root_impl::uid_should_umount(uid) {
-                    flags |= ProcessFlags::PROCESS_ON_DENYLIST;
-                }
-            }
-            match root_impl::get_impl() {
-                root_impl::RootImpl::APatch => flags |= ProcessFlags::PROCESS_ROOT_IS_APATCH,
-                root_impl::RootImpl::KernelSU => flags |= ProcessFlags::PROCESS_ROOT_IS_KSU,
-                root_impl::RootImpl::Magisk => flags |= ProcessFlags::PROCESS_ROOT_IS_MAGISK,
-                _ => panic!("wrong root impl: {:?}", root_impl::get_impl()),
-            }
-            trace!(
-                "Uid {} granted root: {}",
-                uid,
-                flags.contains(ProcessFlags::PROCESS_GRANTED_ROOT)
-            );
-            trace!(
-                "Uid {} on denylist: {}",
-                uid,
-                flags.contains(ProcessFlags::PROCESS_ON_DENYLIST)
-            );
+            let flags = get_process_flags(uid);
             stream.write_u32(flags.bits())?;
         }
         DaemonSocketAction::UpdateMountNamespace => {
@@ -292,12 +506,151 @@ fn handle_daemon_action(
             let fd = save_mount_namespace(-1, namespace_type)?;
             stream.write_u32(fd as u32)?;
         }
+        DaemonSocketAction::GetFlagsTable => {
+            match FLAGS_TABLE
+                .initiated()
+                .then(|| FLAGS_TABLE.open_read_only())
+            {
+                Some(Ok(file)) => {
+                    stream.write_u8(1)?;
+                    stream.send_fd(file.as_raw_fd())?;
+                }
+                _ => stream.write_u8(0)?,
+            }
+        }
+        DaemonSocketAction::GetLinkerCache => {
+            // Validated by the injector against the running linker
+            let data = fs::read(constants::PATH_LINKER_CACHE).unwrap_or_default();
+            stream.write_usize(data.len())?;
+            stream.write_all(&data)?;
+        }
+        DaemonSocketAction::SaveLinkerCache => {
+            let len = stream.read_usize()?;
+            if len > constants::MAX_LINKER_CACHE_SIZE {
+                bail!("linker cache too large: {}", len);
+            }
+            let mut data = vec![0u8; len];
+            stream.read_exact(&mut data)?;
+            // Readers must never see a partially written cache
+            let tmp = format!("{}.tmp", constants::PATH_LINKER_CACHE);
+            fs::write(&tmp, &data)?;
+            fs::rename(&tmp, constants::PATH_LINKER_CACHE)?;
+            debug!("Saved linker cache of {} bytes", len);
+        }
+        DaemonSocketAction::ReportTimings => {
+            let class = if stream.read_u8()? != 0 {
+                ProcessClass::SystemServer
+            } else {
+                ProcessClass::App
+            };
+            let uid = stream.read_u32()?;
+            let len = stream.read_usize()?;
+            if len > timings::MAX_SAMPLES * timings::SAMPLE_SIZE {
+                bail!("too many timing samples: {}", len);
+            }
+            let mut samples = vec![0u8; len];
+            stream.read_exact(&mut samples)?;
+            let len = stream.read_usize()?;
+            if len > timings::MAX_MODULE_SAMPLES * timings::MODULE_SAMPLE_SIZE {
+                bail!("too many module samples: {}", len);
+            }
+            let mut modules = vec![0u8; len];
+            stream.read_exact(&mut modules)?;
+            timings::record(class, uid, &samples, &modules);
+        }
+        DaemonSocketAction::GetTimingStats => {
+            let report = timings::report(|index| {
+                context
+                    .modules
+                    .get(index as usize)
+                    .map(|module| module.name.clone())
+            });
+            stream.write_string(&report)?;
+        }
+        DaemonSocketAction::SetScopedOutUids => {
+            let len = stream.read_usize()?;
+            if len % 4 != 0 || len > 4096 * 4 {
+                bail!("invalid scoped out uids: {}", len);
+            }
+            let mut buf = vec![0u8; len];
+            stream.read_exact(&mut buf)?;
+            *SCOPED_OUT_UIDS.lock().unwrap() = buf
+                .chunks_exact(4)
+                .map(|uid| u32::from_ne_bytes(uid.try_into().unwrap()))
+                .collect();
+            // Cached module counts of these uids are stale either way
+            if FLAGS_TABLE.initiated() {
+                FLAGS_TABLE.invalidate();
+            }
+            stream.write_u8(1)?;
+        }
+        DaemonSocketAction::TakeSpecializeLatency => {
+            let uid = stream.read_u32()?;
+            stream.write_u32(timings::take_specialize_latency(uid))?;
+        }
         DaemonSocketAction::ReadModules => {
-            stream.write_usize(context.modules.len())?;
-            for module in context.modules.iter() {
-                stream.write_string(&module.name)?;
-                stream.send_fd(module.lib_fd.as_raw_fd())?;
+            write_modules(&mut stream, target_modules(context, None), false)?;
+        }
+        DaemonSocketAction::GetSpecializeInfo => {
+            let uid = stream.read_u32()? as i32;
+            let is_system_server = stream.read_u8()? != 0;
+            // An invalidation while the reply is computed keeps it out of the table
+            let generation = FLAGS_TABLE.initiated().then(|| FLAGS_TABLE.generation());
+            let flags = if is_system_server {
+                ProcessFlags::empty()
+            } else {
+                get_process_flags(uid)
+            };
+            // The namespace the app will switch to in its unshare hook, decided the same way
+            let namespace_type = if flags
+                .intersects(ProcessFlags::PROCESS_IS_MANAGER | ProcessFlags::PROCESS_GRANTED_ROOT)
+            {
+                MountNamespace::Root
+            } else {
+                MountNamespace::Module
+            };
+            let needs_namespace = !is_system_server
+                && !flags
+                    .intersects(ProcessFlags::IS_FIRST_PROCESS | ProcessFlags::PROCESS_ON_DENYLIST);
+            // Do not fail the whole request if namespaces are not cached yet,
+            // the injector falls back to UpdateMountNamespace in that case
+            let fd = if needs_namespace {
+                save_mount_namespace(-1, namespace_type).unwrap_or_else(|e| {
+                    debug!("Mount namespace unavailable for uid {}: {}", uid, e);
+                    0
+                })
+            } else {
+                0
+            };
+            stream.write_u32(flags.bits())?;
+            stream.write_u8(namespace_type as u8)?;
+            stream.write_u32(unsafe { libc::getpid() } as u32)?;
+            stream.write_u32(fd as u32)?;
+            let modules = target_modules(context, Some((uid, is_system_server)));
+            if let (false, Some(generation)) = (is_system_server, generation) {
+                FLAGS_TABLE.insert(uid as u32, flags, modules.len() as u32, generation);
             }
+            write_modules(&mut stream, modules, true)?;
+        }
+        DaemonSocketAction::ReportModuleRelro => {
+            let index = stream.read_usize()?;
+            let success = stream.read_u8()? != 0;
+            let Some(module) = context.modules.get(index) else {
+                bail!("RELRO reported for unknown module {}", index);
+            };
+            let mut relro = module.relro.lock().unwrap();
+            // Reports for a memfd dropped on zygote restart are ignored
+            *relro = match std::mem::replace(&mut *relro, Relro::Missing(0)) {
+                Relro::Writing(memfd, ..) if success && seal_memfd(&memfd).is_ok() => {
+                    debug!("RELRO of `{}` is shared now", module.name);
+                    Relro::Ready(memfd)
+                }
+                Relro::Writing(_, attempts, _) => {
+                    warn!("Failed to write RELRO of `{}`", module.name);
+                    Relro::Missing(attempts + 1)
+                }
+                other => other,
+            };
         }
         DaemonSocketAction::RequestCompanionSocket => {
             let index = stream.read_usize()?;
@@ -310,7 +663,7 @@ fn handle_daemon_action(
                 }
             }
             if companion.is_none() {
-                match spawn_companion(&module.name, module.lib_fd.as_raw_fd()) {
+                match spawn_companion(&module.name, module.lib_fd.as_raw_fd(), index) {
                     Ok(c) => {
                         if c.is_some() {
                             trace!("Spawned companion for `{}`", module.name);